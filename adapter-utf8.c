@@ -0,0 +1,782 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+/**
+ * Transcoding adapter
+ * - The adaptee only accepts valid UTF-8, but clients send Latin-1, UTF-16LE
+ *   or raw bytes of unknown quality. An adapter is created for one input
+ *   encoding. It validates and transcodes every message to UTF-8 before it
+ *   reaches the adaptee, and rejects any message that cannot be converted.
+ */
+
+/**
+ * Every conversion has a scalar kernel, which is also the reference, and
+ * SSE2 and AVX2 kernels. The SIMD kernels classify 16 or 32 input bytes at
+ * once. A block that is pure ASCII (most text is) is stored or narrowed in a
+ * single step. When a block is not pure ASCII, the ASCII run before the first
+ * other character is still stored in one step, and that character goes
+ * through the scalar code.
+ *
+ * Only ASCII runs are vectorized. Multibyte characters are validated and
+ * encoded one at a time by the scalar code, so text with few ASCII runs
+ * between them converts at roughly scalar speed.
+ *
+ * A kernel returns the number of UTF-8 bytes it wrote, or -1 if the input is
+ * not valid in its encoding: a lone UTF-16 surrogate, an odd UTF-16 length,
+ * or a malformed, overlong or out-of-range UTF-8 sequence. Kernels may write
+ * up to KERNEL_SLACK bytes past the end of their output.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef long (*Transcode_t)(const uint8_t *in, size_t len, uint8_t *out);
+
+typedef enum {
+    ENCODING_LATIN1,
+    ENCODING_UTF16LE,
+    ENCODING_RAW,
+    NUM_ENCODINGS
+} Encoding_t;
+
+static const char *encodingNames[NUM_ENCODINGS] = {
+    "latin1", "utf16le", "raw"
+};
+
+#define KERNEL_SLACK 32
+
+/* Largest UTF-8 output for len input bytes, not counting KERNEL_SLACK */
+static size_t maxOutput(Encoding_t encoding, size_t len)
+{
+    switch (encoding) {
+    case ENCODING_LATIN1:  return 2 * len;
+    case ENCODING_UTF16LE: return 3 * (len / 2);
+    default:               return len;
+    }
+}
+
+/*
+ * One character at a time. Each step consumes one character at in[*k], writes
+ * its UTF-8 form at out[*o] and advances both offsets.
+ */
+static inline void latin1Step(const uint8_t *in, size_t *k,
+                              uint8_t *out, size_t *o)
+{
+    uint8_t c = in[(*k)++];
+
+    if (c < 0x80) {
+        out[(*o)++] = c;
+    } else {
+        out[(*o)++] = (uint8_t) (0xC0 | c >> 6);
+        out[(*o)++] = (uint8_t) (0x80 | (c & 0x3F));
+    }
+}
+
+static inline int utf16Step(const uint8_t *in, size_t len, size_t *k,
+                            uint8_t *out, size_t *o)
+{
+    uint32_t u = (uint32_t) in[*k] | (uint32_t) in[*k + 1] << 8;
+
+    *k += 2;
+
+    if (u < 0x80) {
+        out[(*o)++] = (uint8_t) u;
+    } else if (u < 0x800) {
+        out[(*o)++] = (uint8_t) (0xC0 | u >> 6);
+        out[(*o)++] = (uint8_t) (0x80 | (u & 0x3F));
+    } else if (u < 0xD800 || u > 0xDFFF) {
+        out[(*o)++] = (uint8_t) (0xE0 | u >> 12);
+        out[(*o)++] = (uint8_t) (0x80 | (u >> 6 & 0x3F));
+        out[(*o)++] = (uint8_t) (0x80 | (u & 0x3F));
+    } else {
+        if (u > 0xDBFF || *k + 2 > len) {
+            return -1;
+        }
+
+        uint32_t low = (uint32_t) in[*k] | (uint32_t) in[*k + 1] << 8;
+
+        if (low < 0xDC00 || low > 0xDFFF) {
+            return -1;
+        }
+        *k += 2;
+
+        uint32_t cp = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+
+        out[(*o)++] = (uint8_t) (0xF0 | cp >> 18);
+        out[(*o)++] = (uint8_t) (0x80 | (cp >> 12 & 0x3F));
+        out[(*o)++] = (uint8_t) (0x80 | (cp >> 6 & 0x3F));
+        out[(*o)++] = (uint8_t) (0x80 | (cp & 0x3F));
+    }
+
+    return 0;
+}
+
+static inline int isCont(uint8_t c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+static inline int utf8Step(const uint8_t *in, size_t len, size_t *k,
+                           uint8_t *out, size_t *o)
+{
+    uint8_t c = in[*k];
+    size_t n;
+
+    if (c < 0x80) {
+        n = 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+    } else {
+        return -1;
+    }
+
+    if (*k + n > len) {
+        return -1;
+    }
+
+    for (size_t j = 1; j < n; j++) {
+        if (!isCont(in[*k + j])) {
+            return -1;
+        }
+    }
+
+    /* reject overlong forms, surrogates and code points above U+10FFFF */
+    uint8_t c1 = n > 1 ? in[*k + 1] : 0;
+
+    if ((c == 0xE0 && c1 < 0xA0) || (c == 0xED && c1 > 0x9F) ||
+        (c == 0xF0 && c1 < 0x90) || (c == 0xF4 && c1 > 0x8F)) {
+        return -1;
+    }
+
+    memcpy(out + *o, in + *k, n);
+    *k += n;
+    *o += n;
+
+    return 0;
+}
+
+/*
+ * Scalar reference kernels
+ */
+long latin1Scalar(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    while (k < len) {
+        latin1Step(in, &k, out, &o);
+    }
+
+    return (long) o;
+}
+
+long utf16Scalar(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    if (len % 2) {
+        return -1;
+    }
+
+    while (k < len) {
+        if (utf16Step(in, len, &k, out, &o)) {
+            return -1;
+        }
+    }
+
+    return (long) o;
+}
+
+long rawScalar(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    while (k < len) {
+        if (utf8Step(in, len, &k, out, &o)) {
+            return -1;
+        }
+    }
+
+    return (long) o;
+}
+
+/*
+ * SIMD kernels
+ */
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+long latin1Sse2(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    while (k + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + k));
+        unsigned mask = (unsigned) _mm_movemask_epi8(v);
+
+        _mm_storeu_si128((__m128i *) (out + o), v);
+
+        if (mask == 0) {
+            k += 16;
+            o += 16;
+        } else {
+            unsigned ascii = (unsigned) __builtin_ctz(mask);
+
+            k += ascii;
+            o += ascii;
+            latin1Step(in, &k, out, &o);
+        }
+    }
+
+    while (k < len) {
+        latin1Step(in, &k, out, &o);
+    }
+
+    return (long) o;
+}
+
+__attribute__((target("avx2")))
+long latin1Avx2(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    while (k + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (in + k));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(v);
+
+        _mm256_storeu_si256((__m256i *) (out + o), v);
+
+        if (mask == 0) {
+            k += 32;
+            o += 32;
+        } else {
+            unsigned ascii = (unsigned) __builtin_ctz(mask);
+
+            k += ascii;
+            o += ascii;
+            latin1Step(in, &k, out, &o);
+        }
+    }
+
+    while (k < len) {
+        latin1Step(in, &k, out, &o);
+    }
+
+    return (long) o;
+}
+
+/*
+ * A UTF-16 unit is ASCII if its top nine bits are clear. Eight ASCII units are
+ * narrowed to eight bytes with one saturating pack.
+ */
+__attribute__((target("sse2")))
+long utf16Sse2(const uint8_t *in, size_t len, uint8_t *out)
+{
+    const __m128i high = _mm_set1_epi16((short) 0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t k = 0, o = 0;
+
+    if (len % 2) {
+        return -1;
+    }
+
+    while (k + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + k));
+        __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, high), zero);
+        unsigned mask = (unsigned) _mm_movemask_epi8(ascii);
+
+        _mm_storel_epi64((__m128i *) (out + o), _mm_packus_epi16(v, v));
+
+        if (mask == 0xFFFF) {
+            k += 16;
+            o += 8;
+        } else {
+            unsigned units = (unsigned) __builtin_ctz(~mask) / 2;
+
+            k += 2 * units;
+            o += units;
+            if (utf16Step(in, len, &k, out, &o)) {
+                return -1;
+            }
+        }
+    }
+
+    while (k < len) {
+        if (utf16Step(in, len, &k, out, &o)) {
+            return -1;
+        }
+    }
+
+    return (long) o;
+}
+
+__attribute__((target("avx2")))
+long utf16Avx2(const uint8_t *in, size_t len, uint8_t *out)
+{
+    const __m256i high = _mm256_set1_epi16((short) 0xFF80);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t k = 0, o = 0;
+
+    if (len % 2) {
+        return -1;
+    }
+
+    while (k + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (in + k));
+        __m256i ascii = _mm256_cmpeq_epi16(_mm256_and_si256(v, high), zero);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(ascii);
+        /* the 256-bit pack works per lane, so pack the two halves instead */
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(v),
+                                         _mm256_extracti128_si256(v, 1));
+
+        _mm_storeu_si128((__m128i *) (out + o), bytes);
+
+        if (mask == 0xFFFFFFFFu) {
+            k += 32;
+            o += 16;
+        } else {
+            unsigned units = (unsigned) __builtin_ctz(~mask) / 2;
+
+            k += 2 * units;
+            o += units;
+            if (utf16Step(in, len, &k, out, &o)) {
+                return -1;
+            }
+        }
+    }
+
+    while (k < len) {
+        if (utf16Step(in, len, &k, out, &o)) {
+            return -1;
+        }
+    }
+
+    return (long) o;
+}
+
+__attribute__((target("sse2")))
+long rawSse2(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    while (k + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + k));
+        unsigned mask = (unsigned) _mm_movemask_epi8(v);
+
+        _mm_storeu_si128((__m128i *) (out + o), v);
+
+        if (mask == 0) {
+            k += 16;
+            o += 16;
+        } else {
+            unsigned ascii = (unsigned) __builtin_ctz(mask);
+
+            k += ascii;
+            o += ascii;
+            if (utf8Step(in, len, &k, out, &o)) {
+                return -1;
+            }
+        }
+    }
+
+    while (k < len) {
+        if (utf8Step(in, len, &k, out, &o)) {
+            return -1;
+        }
+    }
+
+    return (long) o;
+}
+
+__attribute__((target("avx2")))
+long rawAvx2(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t k = 0, o = 0;
+
+    while (k + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (in + k));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(v);
+
+        _mm256_storeu_si256((__m256i *) (out + o), v);
+
+        if (mask == 0) {
+            k += 32;
+            o += 32;
+        } else {
+            unsigned ascii = (unsigned) __builtin_ctz(mask);
+
+            k += ascii;
+            o += ascii;
+            if (utf8Step(in, len, &k, out, &o)) {
+                return -1;
+            }
+        }
+    }
+
+    while (k < len) {
+        if (utf8Step(in, len, &k, out, &o)) {
+            return -1;
+        }
+    }
+
+    return (long) o;
+}
+#endif
+
+/*
+ * Kernel table, indexed by encoding and then by level. A NULL entry is a level
+ * that this build or this CPU does not have.
+ */
+enum { LEVEL_SCALAR, LEVEL_SSE2, LEVEL_AVX2, NUM_LEVELS };
+
+static const char *levelNames[NUM_LEVELS] = { "scalar", "sse2", "avx2" };
+
+static Transcode_t kernels[NUM_ENCODINGS][NUM_LEVELS] = {
+    { latin1Scalar },
+    { utf16Scalar },
+    { rawScalar },
+};
+
+static int bestLevel = -1;
+
+static void initKernels(void)
+{
+    if (bestLevel >= 0) {
+        return;
+    }
+
+    bestLevel = LEVEL_SCALAR;
+
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[ENCODING_LATIN1][LEVEL_SSE2] = latin1Sse2;
+        kernels[ENCODING_UTF16LE][LEVEL_SSE2] = utf16Sse2;
+        kernels[ENCODING_RAW][LEVEL_SSE2] = rawSse2;
+        bestLevel = LEVEL_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[ENCODING_LATIN1][LEVEL_AVX2] = latin1Avx2;
+        kernels[ENCODING_UTF16LE][LEVEL_AVX2] = utf16Avx2;
+        kernels[ENCODING_RAW][LEVEL_AVX2] = rawAvx2;
+        bestLevel = LEVEL_AVX2;
+    }
+#endif
+}
+
+typedef struct Adaptee_s Adaptee_t;
+typedef struct Adapter_s Adapter_t;
+
+/*
+ * The Adaptee stores and prints UTF-8 text, and trusts it to be valid.
+ */
+struct Adaptee_s {
+    char *strbuf;
+    size_t len;
+    size_t capacity;
+
+    void (*storeText)(Adaptee_t *, const char *, size_t);
+    void (*printText)(Adaptee_t *);
+};
+
+struct Adapter_s {
+    Adaptee_t *adaptee;
+    Encoding_t encoding;
+    Transcode_t transcode;
+    uint8_t *buf;
+    size_t capacity;
+
+    /* returns 0, or -1 if the message was rejected */
+    int (*displayText)(Adapter_t *, const void *, size_t);
+};
+typedef Adapter_t Target_t;
+
+void adapteeStoreText(Adaptee_t *adaptee, const char *text, size_t len)
+{
+    if (len + 1 > adaptee->capacity) {
+        adaptee->capacity = 2 * (len + 1);
+        adaptee->strbuf = (char *) realloc(adaptee->strbuf, adaptee->capacity);
+    }
+
+    memcpy(adaptee->strbuf, text, len);
+    adaptee->strbuf[len] = '\0';
+    adaptee->len = len;
+}
+
+void adapteePrintText(Adaptee_t *adaptee)
+{
+    /* the text is valid UTF-8 but may still contain NULs */
+    fwrite(adaptee->strbuf, 1, adaptee->len, stdout);
+    putchar('\n');
+}
+
+Adaptee_t *newAdaptee(void)
+{
+    Adaptee_t *adaptee = (Adaptee_t *) calloc(1, sizeof(Adaptee_t));
+
+    adaptee->storeText = adapteeStoreText;
+    adaptee->printText = adapteePrintText;
+
+    return adaptee;
+}
+
+int adapterDisplayText(Adapter_t *adapter, const void *text, size_t len)
+{
+    Adaptee_t *adaptee = adapter->adaptee;
+    size_t needed = maxOutput(adapter->encoding, len) + KERNEL_SLACK;
+
+    if (needed > adapter->capacity) {
+        adapter->capacity = 2 * needed;
+        adapter->buf = (uint8_t *) realloc(adapter->buf, adapter->capacity);
+    }
+
+    long n = adapter->transcode((const uint8_t *) text, len, adapter->buf);
+
+    printf("text (%s): ", encodingNames[adapter->encoding]);
+
+    if (n < 0) {
+        printf("<rejected, invalid input>\n");
+        return -1;
+    }
+
+    adaptee->storeText(adaptee, (const char *) adapter->buf, (size_t) n);
+    adaptee->printText(adaptee);
+
+    return 0;
+}
+
+Adapter_t *newAdapter(Adaptee_t *adaptee, Encoding_t encoding)
+{
+    Adapter_t *adapter = (Adapter_t *) calloc(1, sizeof(Adapter_t));
+
+    initKernels();
+
+    adapter->adaptee = adaptee;
+    adapter->encoding = encoding;
+    adapter->transcode = kernels[encoding][bestLevel];
+    adapter->displayText = adapterDisplayText;
+
+    return adapter;
+}
+
+/*
+ * Benchmark
+ *
+ * The inputs are the same mostly-ASCII text in each encoding, with an accented
+ * letter every few words and, outside Latin-1, a euro sign and an emoji now
+ * and then. Every kernel's output is compared with the scalar reference before
+ * it is timed.
+ */
+#define BENCH_INPUT (1u << 20)
+#define BENCH_BYTES (64u << 20)
+
+static size_t makeUtf8Text(uint8_t *out, size_t len, int latin1Only)
+{
+    static const char *words[] = {
+        "the ", "adapter ", "converts ", "every ", "message ", "caf\xc3\xa9 ",
+        "to ", "valid ", "text ", "na\xc3\xafve ", "\xe2\x82\xac" "5 ",
+        "ok \xf0\x9f\x98\x80 ",
+    };
+    size_t numWords = latin1Only ? 10 : sizeof(words) / sizeof(words[0]);
+    unsigned seed = 5;
+    size_t o = 0;
+
+    for (;;) {
+        seed = seed * 1103515245u + 12345u;
+
+        const char *w = words[(seed >> 16) % numWords];
+        size_t n = strlen(w);
+
+        if (o + n > len) {
+            return o;
+        }
+
+        memcpy(out + o, w, n);
+        o += n;
+    }
+}
+
+/* Convert valid UTF-8 to Latin-1 or UTF-16LE to produce the other inputs */
+static size_t fromUtf8(const uint8_t *in, size_t len, uint8_t *out,
+                       Encoding_t encoding)
+{
+    size_t o = 0;
+
+    for (size_t k = 0; k < len; ) {
+        uint32_t cp;
+        uint8_t c = in[k];
+
+        if (c < 0x80) {
+            cp = c;
+            k += 1;
+        } else if (c < 0xE0) {
+            cp = (uint32_t) (c & 0x1F) << 6 | (in[k + 1] & 0x3F);
+            k += 2;
+        } else if (c < 0xF0) {
+            cp = (uint32_t) (c & 0x0F) << 12 | (uint32_t) (in[k + 1] & 0x3F) << 6
+                 | (in[k + 2] & 0x3F);
+            k += 3;
+        } else {
+            cp = (uint32_t) (c & 0x07) << 18 | (uint32_t) (in[k + 1] & 0x3F) << 12
+                 | (uint32_t) (in[k + 2] & 0x3F) << 6 | (in[k + 3] & 0x3F);
+            k += 4;
+        }
+
+        if (encoding == ENCODING_LATIN1) {
+            out[o++] = (uint8_t) cp;
+        } else if (cp < 0x10000) {
+            out[o++] = (uint8_t) cp;
+            out[o++] = (uint8_t) (cp >> 8);
+        } else {
+            uint32_t high = 0xD800 + ((cp - 0x10000) >> 10);
+            uint32_t low = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+
+            out[o++] = (uint8_t) high;
+            out[o++] = (uint8_t) (high >> 8);
+            out[o++] = (uint8_t) low;
+            out[o++] = (uint8_t) (low >> 8);
+        }
+    }
+
+    return o;
+}
+
+/* Every kernel must agree with the scalar reference on output and on errors */
+static int checkKernels(uint8_t *inputs[], size_t lens[])
+{
+    static const struct { Encoding_t encoding; const char *bytes; size_t len; }
+    invalid[] = {
+        { ENCODING_UTF16LE, "a\0\x00\xd8" "b\0", 6 },   /* lone high surrogate */
+        { ENCODING_UTF16LE, "a\0\x00\xdc", 4 },         /* lone low surrogate */
+        { ENCODING_UTF16LE, "abc", 3 },                 /* odd length */
+        { ENCODING_RAW, "ok \xc0\x80", 5 },             /* overlong NUL */
+        { ENCODING_RAW, "ok \xed\xa0\x80", 6 },         /* encoded surrogate */
+        { ENCODING_RAW, "ok \xf4\x90\x80\x80", 7 },     /* above U+10FFFF */
+        { ENCODING_RAW, "truncated \xe2\x82", 12 },
+        { ENCODING_RAW, "0123456789abcdefghijklmnopqrstu\x80vwxyz", 37 },
+    };
+    int bad = 0;
+
+    for (int e = 0; e < NUM_ENCODINGS; e++) {
+        size_t cap = maxOutput((Encoding_t) e, lens[e]) + KERNEL_SLACK;
+        uint8_t *want = (uint8_t *) malloc(cap);
+        uint8_t *got = (uint8_t *) malloc(cap);
+        long wantLen = kernels[e][LEVEL_SCALAR](inputs[e], lens[e], want);
+
+        for (int level = 1; level < NUM_LEVELS; level++) {
+            if (!kernels[e][level]) {
+                continue;
+            }
+
+            /* every prefix length near the start exercises the tail paths */
+            for (size_t len = 0; len < 200; len += e == ENCODING_UTF16LE ? 2 : 1) {
+                long a = kernels[e][LEVEL_SCALAR](inputs[e], len, want);
+                long b = kernels[e][level](inputs[e], len, got);
+
+                bad += a != b || (a > 0 && memcmp(want, got, (size_t) a) != 0);
+            }
+
+            long gotLen = kernels[e][level](inputs[e], lens[e], got);
+
+            kernels[e][LEVEL_SCALAR](inputs[e], lens[e], want);
+            bad += gotLen != wantLen ||
+                   memcmp(want, got, (size_t) wantLen) != 0;
+        }
+
+        free(got);
+        free(want);
+    }
+
+    for (size_t k = 0; k < sizeof(invalid) / sizeof(invalid[0]); k++) {
+        uint8_t out[64];
+
+        for (int level = 0; level < NUM_LEVELS; level++) {
+            Transcode_t fn = kernels[invalid[k].encoding][level];
+
+            if (fn) {
+                bad += fn((const uint8_t *) invalid[k].bytes, invalid[k].len,
+                          out) != -1;
+            }
+        }
+    }
+
+    return bad;
+}
+
+int main(void)
+{
+    Adaptee_t *adaptee = newAdaptee();
+    Target_t *fromLatin1 = newAdapter(adaptee, ENCODING_LATIN1);
+    Target_t *fromUtf16 = newAdapter(adaptee, ENCODING_UTF16LE);
+    Target_t *fromRaw = newAdapter(adaptee, ENCODING_RAW);
+
+    fromLatin1->displayText(fromLatin1, "caf\xe9 cr\xe8me", 10);
+    fromUtf16->displayText(fromUtf16, "5\0 \0\xac\x20 \0=\xd8\x00\xde", 12);
+    fromRaw->displayText(fromRaw, "na\xc3\xafve", 6);
+    fromRaw->displayText(fromRaw, "bad \xff byte", 10);
+    fromUtf16->displayText(fromUtf16, "l\0o\0n\0e\0 \0\x00\xd8", 12);
+
+    uint8_t *inputs[NUM_ENCODINGS];
+    size_t lens[NUM_ENCODINGS];
+    uint8_t *text = (uint8_t *) malloc(BENCH_INPUT);
+    size_t textLen;
+
+    textLen = makeUtf8Text(text, BENCH_INPUT, 1);
+    inputs[ENCODING_LATIN1] = (uint8_t *) malloc(BENCH_INPUT);
+    lens[ENCODING_LATIN1] = fromUtf8(text, textLen, inputs[ENCODING_LATIN1],
+                                     ENCODING_LATIN1);
+
+    textLen = makeUtf8Text(text, BENCH_INPUT, 0);
+    inputs[ENCODING_UTF16LE] = (uint8_t *) malloc(2 * BENCH_INPUT);
+    lens[ENCODING_UTF16LE] = fromUtf8(text, textLen, inputs[ENCODING_UTF16LE],
+                                      ENCODING_UTF16LE);
+    inputs[ENCODING_RAW] = text;
+    lens[ENCODING_RAW] = textLen;
+
+    printf("\nKernel check against the scalar reference: %s\n\n",
+           checkKernels(inputs, lens) ? "FAILED" : "ok");
+
+    for (int e = 0; e < NUM_ENCODINGS; e++) {
+        uint8_t *out = (uint8_t *) malloc(maxOutput((Encoding_t) e, lens[e])
+                                          + KERNEL_SLACK);
+        size_t rounds = BENCH_BYTES / lens[e];
+
+        for (int level = 0; level < NUM_LEVELS; level++) {
+            if (!kernels[e][level]) {
+                continue;
+            }
+
+            uint64_t start = nowNs();
+
+            for (size_t r = 0; r < rounds; r++) {
+                kernels[e][level](inputs[e], lens[e], out);
+            }
+
+            double seconds = (nowNs() - start) / 1e9;
+
+            printf("%-7s -> utf8  %-6s %6.2f GB/s of input\n", encodingNames[e],
+                   levelNames[level], rounds * lens[e] / seconds / 1e9);
+        }
+
+        free(out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Zero-copy adapter
+ * - The client hands the adapter a view of its text, a pointer and a length,
+ *   instead of a NUL-terminated string. If the adaptee can consume views, the
+ *   adapter passes the view straight through and not a single byte is copied.
+ *   Otherwise the adapter falls back to the adaptee's store-then-print
+ *   interface, which now keeps the text in a buffer that grows as needed, so
+ *   long messages are no longer cut at 20 bytes.
+ */
+
+/**
+ * A view does not own its bytes. It is only valid for the duration of the
+ * call, so an adaptee that wants to keep the text around must copy it.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct StrView_s {
+    const char *data;
+    size_t len;
+} StrView_t;
+
+StrView_t strView(const char *text)
+{
+    StrView_t view = { text, strlen(text) };
+
+    return view;
+}
+
+typedef struct Adaptee_s Adaptee_t;
+typedef struct Adapter_s Adapter_t;
+
+/*
+ * The Adaptee writes text to an output stream. Every adaptee has the classic
+ * store-then-print interface. A view-capable adaptee also sets printView,
+ * which prints a view directly.
+ */
+struct Adaptee_s {
+    char *strbuf;
+    size_t len;
+    size_t capacity;
+    FILE *out;
+
+    void (*storeText)(Adaptee_t *, StrView_t);
+    void (*printText)(Adaptee_t *);
+    void (*printView)(Adaptee_t *, StrView_t);  /* NULL if not supported */
+};
+
+/*
+ * The Adapter presents the interface the client expects: display a view.
+ */
+struct Adapter_s {
+    Adaptee_t *adaptee;
+
+    void (*displayText)(Adapter_t *, StrView_t);
+};
+typedef Adapter_t Target_t;
+
+void adapteeStoreText(Adaptee_t *adaptee, StrView_t text)
+{
+    if (text.len + 1 > adaptee->capacity) {
+        size_t capacity = adaptee->capacity ? adaptee->capacity : 64;
+
+        while (capacity < text.len + 1) {
+            capacity *= 2;
+        }
+
+        adaptee->strbuf = (char *) realloc(adaptee->strbuf, capacity);
+        adaptee->capacity = capacity;
+    }
+
+    memcpy(adaptee->strbuf, text.data, text.len);
+    adaptee->strbuf[text.len] = '\0';
+    adaptee->len = text.len;
+}
+
+void adapteePrintText(Adaptee_t *adaptee)
+{
+    fwrite(adaptee->strbuf, 1, adaptee->len, adaptee->out);
+    fputc('\n', adaptee->out);
+}
+
+void adapteePrintView(Adaptee_t *adaptee, StrView_t text)
+{
+    fwrite(text.data, 1, text.len, adaptee->out);
+    fputc('\n', adaptee->out);
+}
+
+Adaptee_t *newAdaptee(FILE *out, int acceptsViews)
+{
+    Adaptee_t *adaptee = (Adaptee_t *) calloc(1, sizeof(Adaptee_t));
+
+    adaptee->out = out;
+    adaptee->storeText = adapteeStoreText;
+    adaptee->printText = adapteePrintText;
+    adaptee->printView = acceptsViews ? adapteePrintView : NULL;
+
+    return adaptee;
+}
+
+void adapterDisplayText(Adapter_t *adapter, StrView_t text)
+{
+    Adaptee_t *adaptee = adapter->adaptee;
+
+    fputs("text: ", adaptee->out);
+
+    if (adaptee->printView) {
+        adaptee->printView(adaptee, text);
+    } else {
+        adaptee->storeText(adaptee, text);
+        adaptee->printText(adaptee);
+    }
+}
+
+Adapter_t *newAdapter(Adaptee_t *adaptee)
+{
+    Adapter_t *adapter = (Adapter_t *) malloc(sizeof(Adapter_t));
+
+    adapter->displayText = adapterDisplayText;
+    adapter->adaptee = adaptee;
+
+    return adapter;
+}
+
+/*
+ * Benchmark: adapted bytes/sec for a few message sizes, through an adaptee
+ * that needs the copy and through one that takes views. The output goes to
+ * /dev/null so that the adapter is what gets measured.
+ */
+#define BENCH_BYTES (128u << 20)
+
+static double runBenchmark(Adapter_t *adapter, const char *message, size_t len)
+{
+    StrView_t view = { message, len };
+    size_t iterations = BENCH_BYTES / len;
+    uint64_t start = nowNs();
+
+    for (size_t k = 0; k < iterations; k++) {
+        adapter->displayText(adapter, view);
+    }
+    fflush(adapter->adaptee->out);
+
+    return (double) iterations * len / ((nowNs() - start) / 1e9);
+}
+
+int main(void)
+{
+    Adapter_t *copying = newAdapter(newAdaptee(stdout, 0));
+    Adapter_t *viewing = newAdapter(newAdaptee(stdout, 1));
+    const char *longText = "A MESSAGE THAT IS LONGER THAN TWENTY BYTES";
+
+    copying->displayText(copying, strView("COPYING ADAPTER"));
+    copying->displayText(copying, strView(longText));
+    viewing->displayText(viewing, strView("VIEWING ADAPTER"));
+    viewing->displayText(viewing, strView(longText));
+    printf("\n");
+    fflush(stdout);
+
+    FILE *devNull = fopen("/dev/null", "w");
+    const size_t sizes[] = { 16, 1024, 64 * 1024 };
+    char *message = (char *) malloc(64 * 1024);
+
+    memset(message, 'x', 64 * 1024);
+    copying->adaptee->out = devNull;
+    viewing->adaptee->out = devNull;
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        double copyRate = runBenchmark(copying, message, sizes[k]);
+        double viewRate = runBenchmark(viewing, message, sizes[k]);
+
+        printf("%6zu B messages  copy %8.0f MB/s  view %8.0f MB/s  (%.2fx)\n",
+               sizes[k], copyRate / 1e6, viewRate / 1e6, viewRate / copyRate);
+    }
+
+    fclose(devNull);
+    free(message);
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Scatter-gather batch adapter
+ * - The classic adapter prints through buffered stdio, as adapter.c does: every
+ *   displayText copies the "text: " prefix, the message and the newline into
+ *   the stream's buffer, which is written out whenever it fills. The batch
+ *   adapter only queues the message: it records the shared prefix, the payload
+ *   and the newline as three iovecs pointing at the caller's bytes, and hands
+ *   the whole batch to the adaptee, which emits it with a single writev.
+ */
+
+/**
+ * Nothing is copied, so the caller's strings must stay valid until the batch is
+ * flushed. The batch is flushed automatically when it runs out of iovecs
+ * (IOV_MAX bounds how many one writev can take) and explicitly by the client.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Adaptee_s Adaptee_t;
+typedef struct Adapter_s Adapter_t;
+
+/*
+ * The Adaptee owns a file descriptor and counts the system calls it makes. Its
+ * stdio stream writes through adapteeStreamWrite, so the write calls stdio
+ * makes are counted as well.
+ */
+struct Adaptee_s {
+    int fd;
+    FILE *stream;
+    unsigned long syscalls;
+
+    void (*printText)(Adaptee_t *, const char *, size_t);
+    void (*printTexts)(Adaptee_t *, struct iovec *, int);
+};
+
+static const char prefix[] = "text: ";
+static const char newline[] = "\n";
+
+#define PREFIX_LEN (sizeof(prefix) - 1)
+#define IOVS_PER_MESSAGE 3
+#define BATCH_IOVS (IOV_MAX - IOV_MAX % IOVS_PER_MESSAGE)
+
+struct Adapter_s {
+    Adaptee_t *adaptee;
+
+    /* batch adapter only */
+    struct iovec *iov;
+    int numIov;
+
+    void (*displayText)(Adapter_t *, const char *);
+    void (*flush)(Adapter_t *);
+};
+typedef Adapter_t Target_t;
+
+static ssize_t adapteeStreamWrite(void *cookie, const char *buf, size_t len)
+{
+    Adaptee_t *adaptee = (Adaptee_t *) cookie;
+
+    adaptee->syscalls++;
+
+    return write(adaptee->fd, buf, len);
+}
+
+void adapteePrintText(Adaptee_t *adaptee, const char *text, size_t len)
+{
+    fwrite(text, 1, len, adaptee->stream);
+}
+
+/*
+ * Anything still buffered in the stream goes out first, so that text keeps its
+ * order when both adapters share an adaptee. writev may stop short of the end
+ * on a pipe or after a signal, so keep going from wherever it stopped.
+ */
+void adapteePrintTexts(Adaptee_t *adaptee, struct iovec *iov, int numIov)
+{
+    fflush(adaptee->stream);
+
+    while (numIov > 0) {
+        adaptee->syscalls++;
+
+        ssize_t n = writev(adaptee->fd, iov, numIov);
+
+        if (n < 0) {
+            perror("writev");
+            return;
+        }
+
+        while (numIov > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            numIov--;
+        }
+
+        if (numIov > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+}
+
+Adaptee_t *newAdaptee(int fd)
+{
+    Adaptee_t *adaptee = (Adaptee_t *) calloc(1, sizeof(Adaptee_t));
+
+    adaptee->fd = fd;
+    adaptee->stream = fopencookie(adaptee, "w", (cookie_io_functions_t) {
+        .write = adapteeStreamWrite,
+    });
+    setvbuf(adaptee->stream, NULL, _IOFBF, BUFSIZ);
+    adaptee->printText = adapteePrintText;
+    adaptee->printTexts = adapteePrintTexts;
+
+    return adaptee;
+}
+
+void freeAdaptee(Adaptee_t *adaptee)
+{
+    fclose(adaptee->stream);
+    free(adaptee);
+}
+
+/*
+ * Per-message adapter: prefix, then the message, then its newline, the way the
+ * original adapter prints them.
+ */
+void adapterDisplayText(Adapter_t *adapter, const char *text)
+{
+    Adaptee_t *adaptee = adapter->adaptee;
+
+    adaptee->printText(adaptee, prefix, PREFIX_LEN);
+    adaptee->printText(adaptee, text, strlen(text));
+    adaptee->printText(adaptee, newline, 1);
+}
+
+void adapterFlush(Adapter_t *adapter)
+{
+    fflush(adapter->adaptee->stream);
+}
+
+/*
+ * Batch adapter
+ */
+void batchAdapterFlush(Adapter_t *adapter)
+{
+    if (adapter->numIov > 0) {
+        adapter->adaptee->printTexts(adapter->adaptee, adapter->iov,
+                                     adapter->numIov);
+        adapter->numIov = 0;
+    }
+}
+
+void batchAdapterDisplayText(Adapter_t *adapter, const char *text)
+{
+    if (adapter->numIov + IOVS_PER_MESSAGE > BATCH_IOVS) {
+        batchAdapterFlush(adapter);
+    }
+
+    struct iovec *iov = adapter->iov + adapter->numIov;
+
+    iov[0].iov_base = (void *) prefix;
+    iov[0].iov_len = PREFIX_LEN;
+    iov[1].iov_base = (void *) text;
+    iov[1].iov_len = strlen(text);
+    iov[2].iov_base = (void *) newline;
+    iov[2].iov_len = 1;
+
+    adapter->numIov += IOVS_PER_MESSAGE;
+}
+
+Adapter_t *newAdapter(Adaptee_t *adaptee)
+{
+    Adapter_t *adapter = (Adapter_t *) calloc(1, sizeof(Adapter_t));
+
+    adapter->adaptee = adaptee;
+    adapter->displayText = adapterDisplayText;
+    adapter->flush = adapterFlush;
+
+    return adapter;
+}
+
+Adapter_t *newBatchAdapter(Adaptee_t *adaptee)
+{
+    Adapter_t *adapter = (Adapter_t *) calloc(1, sizeof(Adapter_t));
+
+    adapter->adaptee = adaptee;
+    adapter->iov = (struct iovec *) malloc(BATCH_IOVS * sizeof(struct iovec));
+    adapter->displayText = batchAdapterDisplayText;
+    adapter->flush = batchAdapterFlush;
+
+    return adapter;
+}
+
+/*
+ * Benchmark: messages/sec and system calls per message, per-message adapter
+ * against batch adapter, into a pipe that a reader thread drains and into a
+ * regular file.
+ */
+#define BENCH_MESSAGES 200000
+#define NUM_DISTINCT 64
+
+static char *messages[NUM_DISTINCT];
+
+static void * drainPipe(void *arg)
+{
+    int fd = *(int *) arg;
+    char buf[65536];
+
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+
+    return NULL;
+}
+
+static void runBenchmark(const char *sink, int fd, int batched)
+{
+    Adaptee_t *adaptee = newAdaptee(fd);
+    Adapter_t *adapter = batched ? newBatchAdapter(adaptee)
+                                 : newAdapter(adaptee);
+    uint64_t start = nowNs();
+
+    for (unsigned k = 0; k < BENCH_MESSAGES; k++) {
+        adapter->displayText(adapter, messages[k % NUM_DISTINCT]);
+    }
+    adapter->flush(adapter);
+
+    uint64_t elapsed = nowNs() - start;
+
+    printf("%-5s %-12s %10.0f messages/s  %8lu syscalls  %.4f per message\n",
+           sink, batched ? "batch" : "stdio",
+           BENCH_MESSAGES / (elapsed / 1e9), adaptee->syscalls,
+           (double) adaptee->syscalls / BENCH_MESSAGES);
+
+    freeAdaptee(adaptee);
+}
+
+int main(int argc, char *argv[])
+{
+    Adaptee_t *adaptee = newAdaptee(STDOUT_FILENO);
+    Target_t *single = newAdapter(adaptee);
+    Target_t *batch = newBatchAdapter(adaptee);
+
+    single->displayText(single, "PER-MESSAGE ADAPTER");
+    batch->displayText(batch, "BATCH ADAPTER, FIRST MESSAGE");
+    batch->displayText(batch, "BATCH ADAPTER, SECOND MESSAGE");
+    batch->flush(batch);
+    printf("%lu system calls for three messages\n\n", adaptee->syscalls);
+    fflush(stdout);
+
+    for (int k = 0; k < NUM_DISTINCT; k++) {
+        size_t len = 16 + (size_t) (k * 37) % 100;
+
+        messages[k] = (char *) malloc(len + 1);
+        memset(messages[k], 'a' + k % 26, len);
+        messages[k][len] = '\0';
+    }
+
+    for (int batched = 0; batched <= 1; batched++) {
+        int fds[2];
+        pthread_t reader;
+
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            return 1;
+        }
+
+        pthread_create(&reader, NULL, drainPipe, &fds[0]);
+        runBenchmark("pipe", fds[1], batched);
+        close(fds[1]);
+        pthread_join(reader, NULL);
+        close(fds[0]);
+    }
+
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/adapter-writev.out",
+             argc > 1 ? argv[1] : "/tmp");
+
+    for (int batched = 0; batched <= 1; batched++) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0) {
+            perror(path);
+            return 1;
+        }
+
+        runBenchmark("file", fd, batched);
+        close(fd);
+    }
+
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+/**
+ * CPU-dispatched bridge
+ * - The implementation is selected at run-time from the features of the CPU
+ *   the program happens to run on. The abstraction, and therefore every
+ *   client, stays the same whichever implementation is picked.
+ */
+
+/**
+ * The kernel behind the bridge counts how often a byte occurs in a buffer, the
+ * same scan memchr does but over the whole buffer. There are three concrete
+ * implementors:
+ * - scalar, portable C
+ * - SSE2, 16 bytes per compare, popcnt on the match mask
+ * - AVX2, 32 bytes per compare
+ *
+ * The choice is made once, when the abstraction is created. Setting the
+ * BRIDGE_IMPL environment variable to "scalar", "sse2" or "avx2" forces a
+ * particular implementor, which is how each path is tested on a machine that
+ * would otherwise always pick the widest one.
+ */
+
+typedef size_t (*CountFn_t)(const unsigned char *buf, size_t len,
+                            unsigned char byte);
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+size_t impScalarOperation(const unsigned char *buf, size_t len,
+                          unsigned char byte)
+{
+    size_t count = 0;
+
+    for (size_t k = 0; k < len; k++) {
+        count += buf[k] == byte;
+    }
+
+    return count;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2,popcnt")))
+size_t impSse2Operation(const unsigned char *buf, size_t len,
+                        unsigned char byte)
+{
+    __m128i needle = _mm_set1_epi8((char) byte);
+    size_t count = 0;
+    size_t k = 0;
+
+    for (; k + 16 <= len; k += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + k));
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+
+        count += (size_t) _mm_popcnt_u32(mask);
+    }
+
+    return count + impScalarOperation(buf + k, len - k, byte);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t impAvx2Operation(const unsigned char *buf, size_t len,
+                        unsigned char byte)
+{
+    __m256i needle = _mm256_set1_epi8((char) byte);
+    size_t count = 0;
+    size_t k = 0;
+
+    /* two vectors per iteration to keep both load ports busy */
+    for (; k + 64 <= len; k += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (buf + k));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (buf + k + 32));
+        unsigned ma = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, needle));
+        unsigned mb = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, needle));
+
+        count += (size_t) _mm_popcnt_u32(ma) + (size_t) _mm_popcnt_u32(mb);
+    }
+
+    for (; k + 32 <= len; k += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (buf + k));
+        unsigned ma = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, needle));
+
+        count += (size_t) _mm_popcnt_u32(ma);
+    }
+
+    return count + impScalarOperation(buf + k, len - k, byte);
+}
+#endif
+
+/*
+ * Implementor
+ */
+typedef struct Implementor_s {
+    const char *name;
+    CountFn_t operation;
+    int (*supported)(void);
+} Implementor_t;
+
+static int alwaysSupported(void)
+{
+    return 1;
+}
+
+#ifdef HAVE_X86_KERNELS
+static int sse2Supported(void)
+{
+    return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt");
+}
+
+static int avx2Supported(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+#endif
+
+/* widest first, the first supported one wins */
+static const Implementor_t implementors[] = {
+#ifdef HAVE_X86_KERNELS
+    { "avx2", impAvx2Operation, avx2Supported },
+    { "sse2", impSse2Operation, sse2Supported },
+#endif
+    { "scalar", impScalarOperation, alwaysSupported },
+};
+
+#define NUM_IMPLEMENTORS (sizeof(implementors) / sizeof(implementors[0]))
+
+/*
+ * Pick the implementor for this CPU, unless BRIDGE_IMPL forces one.
+ */
+const Implementor_t *selectImplementor(void)
+{
+    const char *forced = getenv("BRIDGE_IMPL");
+
+    for (size_t k = 0; k < NUM_IMPLEMENTORS; k++) {
+        const Implementor_t *imp = &implementors[k];
+
+        if (forced && strcmp(forced, imp->name) != 0) {
+            continue;
+        }
+
+        if (imp->supported()) {
+            return imp;
+        }
+    }
+
+    if (forced) {
+        fprintf(stderr, "BRIDGE_IMPL=%s is not available on this CPU\n", forced);
+        exit(1);
+    }
+
+    return &implementors[NUM_IMPLEMENTORS - 1];
+}
+
+/*
+ * Abstraction
+ */
+typedef struct Abstraction_s {
+    const Implementor_t *imp;
+    size_t (*operation)(struct Abstraction_s *abs, const unsigned char *buf,
+                        size_t len, unsigned char byte);
+} Abstraction_t;
+
+size_t absOperation(Abstraction_t *abs, const unsigned char *buf, size_t len,
+                    unsigned char byte)
+{
+    return abs->imp->operation(buf, len, byte);
+}
+
+Abstraction_t *newAbstraction(const Implementor_t *imp)
+{
+    Abstraction_t *abs = (Abstraction_t *) malloc(sizeof(Abstraction_t));
+
+    abs->imp = imp;
+    abs->operation = absOperation;
+
+    return abs;
+}
+
+/*
+ * Test: every implementor this CPU supports must agree with the scalar one on
+ * all lengths and alignments, including the tails the vector loops leave over.
+ */
+static int testImplementors(const unsigned char *buf)
+{
+    int failures = 0;
+
+    for (size_t k = 0; k < NUM_IMPLEMENTORS; k++) {
+        const Implementor_t *imp = &implementors[k];
+
+        if (!imp->supported()) {
+            printf("test %-7s skipped, not supported\n", imp->name);
+            continue;
+        }
+
+        int bad = 0;
+
+        for (size_t offset = 0; offset < 64; offset++) {
+            for (size_t len = 0; len < 300; len++) {
+                unsigned char byte = buf[offset + len / 2];
+
+                if (imp->operation(buf + offset, len, byte)
+                    != impScalarOperation(buf + offset, len, byte)) {
+                    bad++;
+                }
+            }
+        }
+
+        printf("test %-7s %s\n", imp->name, bad ? "FAILED" : "ok");
+        failures += bad;
+    }
+
+    return failures;
+}
+
+/*
+ * Benchmark: each supported implementor over buffers from 64 B to 64 MB.
+ */
+#define MAX_BUF (64u << 20)
+
+static void benchImplementor(const Implementor_t *imp, const unsigned char *buf)
+{
+    printf("%-7s", imp->name);
+
+    for (size_t len = 64; len <= MAX_BUF; len *= 16) {
+        /* roughly 256 MB of scanning per size */
+        size_t reps = ((size_t) 256 << 20) / len;
+        volatile size_t sink = 0;
+        uint64_t start = nowNs();
+
+        for (size_t r = 0; r < reps; r++) {
+            sink += imp->operation(buf, len, 'e');
+        }
+
+        uint64_t elapsed = nowNs() - start;
+
+        printf(" %8.2f", (double) len * reps / elapsed);
+    }
+
+    printf("\n");
+}
+
+int main(void)
+{
+    unsigned char *buf = (unsigned char *) malloc(MAX_BUF);
+    unsigned seed = 1;
+
+    for (size_t k = 0; k < MAX_BUF; k++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[k] = (unsigned char) ('a' + (seed >> 16) % 26);
+    }
+
+    /*
+     * The client only ever talks to the abstraction. Which implementor does
+     * the work was decided by the CPU.
+     */
+    Abstraction_t *abs = newAbstraction(selectImplementor());
+
+    printf("Selected implementor: %s\n", abs->imp->name);
+    printf("'e' occurs %zu times in the first 1 MB\n\n",
+           abs->operation(abs, buf, 1u << 20, 'e'));
+
+    int failures = testImplementors(buf);
+
+    printf("\nGB/s     ");
+    for (size_t len = 64; len <= MAX_BUF; len *= 16) {
+        if (len < 1024) {
+            printf(" %6zu B", len);
+        } else if (len < (1u << 20)) {
+            printf(" %5zu KB", len >> 10);
+        } else {
+            printf(" %5zu MB", len >> 20);
+        }
+    }
+    printf("\n");
+
+    for (size_t k = 0; k < NUM_IMPLEMENTORS; k++) {
+        if (implementors[k].supported()) {
+            benchImplementor(&implementors[k], buf);
+        }
+    }
+
+    free(buf);
+
+    return failures != 0;
+}
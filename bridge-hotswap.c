@@ -0,0 +1,356 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Hot-swappable bridge
+ * - The implementation of an abstraction is switched at run-time while other
+ *   threads keep calling through the abstraction.
+ */
+
+/**
+ * The abstraction publishes its implementor through an atomic pointer.
+ * Implementors are immutable once published, so a caller always sees a
+ * complete implementor: either the old one or the new one, never a mix.
+ *
+ * Callers take no locks. Each calling thread owns a counter that is odd while
+ * it is inside absOperation. After swapping the pointer, setImplementation
+ * waits until every thread that was inside absOperation at the time of the
+ * swap has left it (a grace period). Only then is the old implementor retired,
+ * since nobody can still be using it.
+ *
+ * A thread gets its counter on its first call and gives it back when it exits,
+ * so MAX_READERS limits the threads calling at the same time, not over the
+ * process's lifetime. Counters are never reset, so a counter taken over by a
+ * new thread still changes whenever a grace period needs it to. Swaps need no
+ * lock among themselves: each one waits for its own grace period and retires
+ * only the implementor it replaced.
+ */
+
+typedef struct Implementor_s {
+    long (*operation)(const struct Implementor_s *imp, long arg);
+
+    /* implementation specific state, never changes once published */
+    long factor;
+    long check;
+} Implementor_t;
+
+static atomic_long implementorsAlive;
+
+static void checkImplementor(const Implementor_t *imp)
+{
+    /* a torn or freed implementor would not pass this */
+    if (imp->check != ~imp->factor) {
+        fprintf(stderr, "inconsistent implementor\n");
+        abort();
+    }
+}
+
+long impAOperation(const Implementor_t *imp, long arg)
+{
+    checkImplementor(imp);
+
+    return arg + imp->factor;
+}
+
+long impBOperation(const Implementor_t *imp, long arg)
+{
+    checkImplementor(imp);
+
+    return arg * imp->factor;
+}
+
+Implementor_t *newImplementor(long (*operation)(const Implementor_t *, long),
+                              long factor)
+{
+    Implementor_t *imp = (Implementor_t *) malloc(sizeof(Implementor_t));
+
+    imp->operation = operation;
+    imp->factor = factor;
+    imp->check = ~factor;
+
+    atomic_fetch_add(&implementorsAlive, 1);
+
+    return imp;
+}
+
+void freeImplementor(Implementor_t *imp)
+{
+    imp->check = 0;
+    free(imp);
+
+    atomic_fetch_sub(&implementorsAlive, 1);
+}
+
+/*
+ * Reader registry used to detect grace periods
+ */
+#define MAX_READERS 64
+
+typedef struct Reader_s {
+    atomic_ulong seq;  /* odd while inside absOperation */
+    atomic_int inUse;
+    char pad[64 - sizeof(atomic_ulong) - sizeof(atomic_int)];
+} Reader_t;
+
+static Reader_t readers[MAX_READERS];
+static atomic_int numReaders;   /* counters ever used, a high-water mark */
+static _Thread_local Reader_t *myReader;
+
+static pthread_key_t readerKey;
+static pthread_once_t readerKeyOnce = PTHREAD_ONCE_INIT;
+
+/* Runs when a thread that has called absOperation exits */
+static void unregisterReader(void *arg)
+{
+    Reader_t *r = (Reader_t *) arg;
+
+    atomic_store(&r->inUse, 0);
+}
+
+static void createReaderKey(void)
+{
+    pthread_key_create(&readerKey, unregisterReader);
+}
+
+static Reader_t * registerReader(void)
+{
+    pthread_once(&readerKeyOnce, createReaderKey);
+
+    for (int k = 0; k < MAX_READERS; k++) {
+        int unused = 0;
+
+        if (atomic_compare_exchange_strong(&readers[k].inUse, &unused, 1)) {
+            int n = atomic_load(&numReaders);
+
+            while (n <= k && !atomic_compare_exchange_weak(&numReaders, &n, k + 1)) {
+            }
+
+            pthread_setspecific(readerKey, &readers[k]);
+
+            return &readers[k];
+        }
+    }
+
+    fprintf(stderr, "too many readers\n");
+    exit(1);
+}
+
+/* Yield a few times, then sleep for longer and longer, up to 1 ms */
+static void backoff(int *round)
+{
+    if (*round < 8) {
+        sched_yield();
+    } else {
+        long ns = 1000L << (*round < 18 ? *round - 8 : 10);
+        struct timespec ts = { 0, ns > 1000000 ? 1000000 : ns };
+
+        nanosleep(&ts, NULL);
+    }
+    (*round)++;
+}
+
+static void waitForReaders(void)
+{
+    int n = atomic_load(&numReaders);
+    unsigned long snapshot[MAX_READERS];
+
+    for (int k = 0; k < n; k++) {
+        snapshot[k] = atomic_load(&readers[k].seq);
+    }
+
+    for (int k = 0; k < n; k++) {
+        /* only readers that were inside at the swap need to be waited on */
+        if (snapshot[k] & 1) {
+            int round = 0;
+
+            while (atomic_load(&readers[k].seq) == snapshot[k]) {
+                backoff(&round);
+            }
+        }
+    }
+}
+
+/*
+ * Abstraction
+ */
+typedef struct Abstraction_s {
+    _Atomic(Implementor_t *) imp;
+
+    long (*operation)(struct Abstraction_s *abs, long arg);
+    void (*setImplementation)(struct Abstraction_s *abs, Implementor_t *imp);
+} Abstraction_t;
+
+long absOperation(Abstraction_t *abs, long arg)
+{
+    Reader_t *r = myReader;
+    long result;
+
+    if (!r) {
+        r = myReader = registerReader();
+    }
+
+    atomic_fetch_add(&r->seq, 1);
+
+    Implementor_t *imp = atomic_load(&abs->imp);
+
+    result = imp->operation(imp, arg);
+
+    atomic_fetch_add(&r->seq, 1);
+
+    return result;
+}
+
+/*
+ * Publish a new implementor and retire the previous one once no caller can
+ * still be using it.
+ */
+void setImplementation(Abstraction_t *abs, Implementor_t *concreteImp)
+{
+    Implementor_t *old = atomic_exchange(&abs->imp, concreteImp);
+
+    waitForReaders();
+
+    if (old) {
+        freeImplementor(old);
+    }
+}
+
+Abstraction_t *newAbstraction(Implementor_t *imp)
+{
+    Abstraction_t *abs = (Abstraction_t *) malloc(sizeof(Abstraction_t));
+
+    atomic_init(&abs->imp, imp);
+    abs->operation = absOperation;
+    abs->setImplementation = setImplementation;
+
+    return abs;
+}
+
+/*
+ * Benchmark
+ *
+ * Caller threads keep going through the abstraction while a switcher thread
+ * replaces the implementor as fast as it can.
+ */
+#define BENCH_THREADS 4
+#define BENCH_NS 300000000ull
+
+static Abstraction_t *benchAbs;
+static atomic_int benchStop;
+
+static void * callerThread(void *arg)
+{
+    unsigned long calls = 0;
+    long acc = 0;
+
+    while (!atomic_load_explicit(&benchStop, memory_order_relaxed)) {
+        acc = benchAbs->operation(benchAbs, acc & 0xff);
+        calls++;
+    }
+
+    *(unsigned long *) arg = calls;
+
+    return NULL;
+}
+
+static void * switcherThread(void *arg)
+{
+    unsigned long swaps = 0;
+
+    while (!atomic_load(&benchStop)) {
+        long factor = (long) (swaps % 7) + 1;
+
+        benchAbs->setImplementation(benchAbs, newImplementor(
+            swaps & 1 ? impBOperation : impAOperation, factor));
+        swaps++;
+    }
+
+    *(unsigned long *) arg = swaps;
+
+    return NULL;
+}
+
+static void runBenchmark(int callers, int switchers)
+{
+    pthread_t threads[BENCH_THREADS], switcher[BENCH_THREADS];
+    unsigned long calls[BENCH_THREADS], swaps[BENCH_THREADS];
+    unsigned long total = 0, totalSwaps = 0;
+    char label[32] = "";
+
+    atomic_store(&benchStop, 0);
+
+    for (int t = 0; t < callers; t++) {
+        pthread_create(&threads[t], NULL, callerThread, &calls[t]);
+    }
+    for (int t = 0; t < switchers; t++) {
+        pthread_create(&switcher[t], NULL, switcherThread, &swaps[t]);
+    }
+
+    struct timespec ts = { 0, BENCH_NS };
+    nanosleep(&ts, NULL);
+    atomic_store(&benchStop, 1);
+
+    for (int t = 0; t < callers; t++) {
+        pthread_join(threads[t], NULL);
+        total += calls[t];
+    }
+    for (int t = 0; t < switchers; t++) {
+        pthread_join(switcher[t], NULL);
+        totalSwaps += swaps[t];
+    }
+
+    if (switchers) {
+        snprintf(label, sizeof(label), "%d switcher(s)", switchers);
+    }
+    printf("%d caller(s) %-14s %12.0f calls/s %10.0f swaps/s\n",
+           callers, label, total / (BENCH_NS / 1e9), totalSwaps / (BENCH_NS / 1e9));
+}
+
+static void * shortCallerThread(void *arg)
+{
+    *(long *) arg = benchAbs->operation(benchAbs, 1);
+
+    return NULL;
+}
+
+int main(void)
+{
+    Abstraction_t *abs = newAbstraction(newImplementor(impAOperation, 10));
+
+    printf("Implementation A: 5 -> %ld\n", abs->operation(abs, 5));
+
+    abs->setImplementation(abs, newImplementor(impBOperation, 10));
+    printf("Implementation B: 5 -> %ld\n\n", abs->operation(abs, 5));
+
+    benchAbs = abs;
+    for (int callers = 1; callers <= BENCH_THREADS; callers *= 2) {
+        runBenchmark(callers, 0);
+        runBenchmark(callers, 1);
+    }
+
+    /* far more calling threads over time than there are reader counters */
+    for (int round = 0; round < 4 * MAX_READERS / BENCH_THREADS; round++) {
+        pthread_t threads[BENCH_THREADS];
+        long results[BENCH_THREADS];
+
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            pthread_create(&threads[t], NULL, shortCallerThread, &results[t]);
+        }
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+    printf("\n%d short-lived calling threads, %d reader counters used\n",
+           4 * MAX_READERS, atomic_load(&numReaders));
+
+    /* every retired implementor has been freed, only the current one is left */
+    printf("Implementors alive: %ld\n", atomic_load(&implementorsAlive));
+
+    return 0;
+}
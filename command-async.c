@@ -0,0 +1,430 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Asynchronous invoker
+ * - Commands are specified by one thread and executed at a different time by
+ *   another. Many producer threads hand commands to the invoker, and one or
+ *   more executor threads drain and execute them.
+ */
+
+/**
+ * The invoker keeps submitted commands in a bounded ring buffer that is safe
+ * for many producers and many consumers without locks. Each slot carries a
+ * sequence number that says whether it is free for the producer that claimed
+ * position `pos` (seq == pos) or filled for the consumer at that position
+ * (seq == pos + 1).
+ *
+ * Executors take up to DRAIN_BATCH commands at a time and run them in one go.
+ * When the ring is full, submit applies backpressure: the producer backs off
+ * until an executor has made room, so memory never grows without bound.
+ *
+ * For comparison, the same invoker is also built on a mutex and two condition
+ * variables.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* i.e. The object that will execute a command's action */
+typedef struct Receiver_s {
+    atomic_ulong actions;
+    void (*action)(struct Receiver_s *receiver);
+} Receiver_t;
+
+void receiverAction(Receiver_t *receiver)
+{
+    atomic_fetch_add_explicit(&receiver->actions, 1, memory_order_relaxed);
+}
+
+Receiver_t * newReceiver(void)
+{
+    Receiver_t *receiver = (Receiver_t *) malloc(sizeof(Receiver_t));
+
+    atomic_init(&receiver->actions, 0);
+    receiver->action = receiverAction;
+
+    return receiver;
+}
+
+typedef struct Command_s {
+    Receiver_t *receiver;
+    void (*execute)(struct Command_s *command);
+} Command_t;
+
+void commandExecute(Command_t *command)
+{
+    command->receiver->action(command->receiver);
+}
+
+Command_t * newCommand(Receiver_t *receiver)
+{
+    Command_t *command = (Command_t *) malloc(sizeof(Command_t));
+
+    command->receiver = receiver;
+    command->execute = commandExecute;
+
+    return command;
+}
+
+/*
+ * Lock-free bounded ring buffer
+ */
+typedef struct Cell_s {
+    atomic_size_t seq;
+    Command_t *command;
+} Cell_t;
+
+typedef struct Ring_s {
+    Cell_t *cells;
+    size_t mask;
+
+    _Alignas(64) atomic_size_t head;  /* next position to fill */
+    _Alignas(64) atomic_size_t tail;  /* next position to drain */
+} Ring_t;
+
+void ringInit(Ring_t *ring, size_t capacity)
+{
+    ring->cells = (Cell_t *) malloc(capacity * sizeof(Cell_t));
+    ring->mask = capacity - 1;
+
+    for (size_t k = 0; k < capacity; k++) {
+        atomic_init(&ring->cells[k].seq, k);
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+int ringPush(Ring_t *ring, Command_t *command)
+{
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    for (;;) {
+        Cell_t *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                cell->command = command;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0; /* full */
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+Command_t * ringPop(Ring_t *ring)
+{
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (;;) {
+        Cell_t *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                Command_t *command = cell->command;
+
+                /* hand the slot back to producers one lap later */
+                atomic_store_explicit(&cell->seq, pos + ring->mask + 1,
+                                      memory_order_release);
+                return command;
+            }
+        } else if (diff < 0) {
+            return NULL; /* empty */
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Asynchronous invoker
+ */
+#define DRAIN_BATCH 64
+#define MAX_EXECUTORS 8
+
+typedef struct AsyncInvoker_s {
+    Ring_t ring;
+
+    /* used by the mutex+condvar variant only */
+    Command_t **queue;
+    size_t capacity, qHead, qCount;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    atomic_int stopping;
+    int numExecutors;
+    pthread_t executors[MAX_EXECUTORS];
+
+    void (*submit)(struct AsyncInvoker_s *invoker, Command_t *command);
+    void (*shutdown)(struct AsyncInvoker_s *invoker);
+} AsyncInvoker_t;
+
+static void backoff(unsigned *spins)
+{
+    if (++*spins < 64) {
+        return;
+    }
+
+    if (*spins < 1024) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, 50000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+void lockFreeSubmit(AsyncInvoker_t *invoker, Command_t *command)
+{
+    unsigned spins = 0;
+
+    /* backpressure: wait for an executor to make room */
+    while (!ringPush(&invoker->ring, command)) {
+        backoff(&spins);
+    }
+}
+
+static void * lockFreeExecutor(void *arg)
+{
+    AsyncInvoker_t *invoker = (AsyncInvoker_t *) arg;
+    Command_t *batch[DRAIN_BATCH];
+    unsigned spins = 0;
+
+    for (;;) {
+        /* read the flag first so that an empty drain after it is final */
+        int stopping = atomic_load(&invoker->stopping);
+        size_t n = 0;
+
+        while (n < DRAIN_BATCH && (batch[n] = ringPop(&invoker->ring))) {
+            n++;
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            batch[k]->execute(batch[k]);
+        }
+
+        if (n > 0) {
+            spins = 0;
+        } else if (stopping) {
+            break; /* stopped and nothing left */
+        } else {
+            backoff(&spins);
+        }
+    }
+
+    return NULL;
+}
+
+void mutexSubmit(AsyncInvoker_t *invoker, Command_t *command)
+{
+    pthread_mutex_lock(&invoker->lock);
+
+    while (invoker->qCount == invoker->capacity) {
+        pthread_cond_wait(&invoker->notFull, &invoker->lock);
+    }
+
+    invoker->queue[(invoker->qHead + invoker->qCount) % invoker->capacity]
+        = command;
+    invoker->qCount++;
+
+    pthread_cond_signal(&invoker->notEmpty);
+    pthread_mutex_unlock(&invoker->lock);
+}
+
+static void * mutexExecutor(void *arg)
+{
+    AsyncInvoker_t *invoker = (AsyncInvoker_t *) arg;
+    Command_t *batch[DRAIN_BATCH];
+
+    for (;;) {
+        size_t n = 0;
+
+        pthread_mutex_lock(&invoker->lock);
+
+        while (invoker->qCount == 0 && !atomic_load(&invoker->stopping)) {
+            pthread_cond_wait(&invoker->notEmpty, &invoker->lock);
+        }
+
+        while (n < DRAIN_BATCH && invoker->qCount > 0) {
+            batch[n++] = invoker->queue[invoker->qHead];
+            invoker->qHead = (invoker->qHead + 1) % invoker->capacity;
+            invoker->qCount--;
+        }
+
+        pthread_cond_broadcast(&invoker->notFull);
+        pthread_mutex_unlock(&invoker->lock);
+
+        if (n == 0) {
+            break; /* stopped and nothing left */
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            batch[k]->execute(batch[k]);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Stop accepting work, let the executors finish what is queued and join them.
+ */
+void invokerShutdown(AsyncInvoker_t *invoker)
+{
+    pthread_mutex_lock(&invoker->lock);
+    atomic_store(&invoker->stopping, 1);
+    pthread_cond_broadcast(&invoker->notEmpty);
+    pthread_mutex_unlock(&invoker->lock);
+
+    for (int k = 0; k < invoker->numExecutors; k++) {
+        pthread_join(invoker->executors[k], NULL);
+    }
+}
+
+/* capacity must be a power of two */
+AsyncInvoker_t * newAsyncInvoker(size_t capacity, int numExecutors,
+                                 int lockFree)
+{
+    AsyncInvoker_t *invoker = (AsyncInvoker_t *) calloc(1, sizeof(AsyncInvoker_t));
+
+    ringInit(&invoker->ring, capacity);
+
+    invoker->queue = (Command_t **) malloc(capacity * sizeof(Command_t *));
+    invoker->capacity = capacity;
+    pthread_mutex_init(&invoker->lock, NULL);
+    pthread_cond_init(&invoker->notEmpty, NULL);
+    pthread_cond_init(&invoker->notFull, NULL);
+
+    invoker->submit = lockFree ? lockFreeSubmit : mutexSubmit;
+    invoker->shutdown = invokerShutdown;
+
+    invoker->numExecutors = numExecutors;
+    for (int k = 0; k < numExecutors; k++) {
+        pthread_create(&invoker->executors[k], NULL,
+                       lockFree ? lockFreeExecutor : mutexExecutor, invoker);
+    }
+
+    return invoker;
+}
+
+/*
+ * Benchmark
+ */
+#define MAX_PRODUCERS 4
+#define COMMANDS_PER_PRODUCER 200000
+#define RING_CAPACITY 4096
+
+typedef struct Producer_s {
+    AsyncInvoker_t *invoker;
+    Command_t *command;
+    uint64_t *latencies;
+} Producer_t;
+
+static void * producerThread(void *arg)
+{
+    Producer_t *p = (Producer_t *) arg;
+
+    for (int k = 0; k < COMMANDS_PER_PRODUCER; k++) {
+        uint64_t start = nowNs();
+
+        p->invoker->submit(p->invoker, p->command);
+
+        p->latencies[k] = nowNs() - start;
+    }
+
+    return NULL;
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void runBenchmark(int producers, int lockFree)
+{
+    Receiver_t *receiver = newReceiver();
+    Command_t *command = newCommand(receiver);
+    AsyncInvoker_t *invoker = newAsyncInvoker(RING_CAPACITY, 1, lockFree);
+    size_t total = (size_t) producers * COMMANDS_PER_PRODUCER;
+    uint64_t *latencies = (uint64_t *) malloc(total * sizeof(uint64_t));
+    pthread_t threads[MAX_PRODUCERS];
+    Producer_t args[MAX_PRODUCERS];
+    uint64_t start = nowNs();
+
+    for (int t = 0; t < producers; t++) {
+        args[t].invoker = invoker;
+        args[t].command = command;
+        args[t].latencies = &latencies[t * COMMANDS_PER_PRODUCER];
+        pthread_create(&threads[t], NULL, producerThread, &args[t]);
+    }
+
+    for (int t = 0; t < producers; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    invoker->shutdown(invoker);
+
+    uint64_t elapsed = nowNs() - start;
+
+    qsort(latencies, total, sizeof(uint64_t), compareU64);
+
+    printf("%-14s %d producer(s) %10.0f cmds/s  enqueue p50 %6.0f ns  p99 %8.0f ns%s\n",
+           lockFree ? "lock-free ring" : "mutex+condvar", producers,
+           total / (elapsed / 1e9), (double) latencies[total / 2],
+           (double) latencies[total * 99 / 100],
+           atomic_load(&receiver->actions) == total ? "" : "  (LOST COMMANDS)");
+
+    free(latencies);
+}
+
+int main(void)
+{
+    Receiver_t *receiver = newReceiver();
+    Command_t *concreteCommand = newCommand(receiver);
+    AsyncInvoker_t *invoker = newAsyncInvoker(8, 2, 1);
+
+    /* Submitting returns immediately, the executors run the commands */
+    for (int k = 0; k < 100; k++) {
+        invoker->submit(invoker, concreteCommand);
+    }
+    invoker->shutdown(invoker);
+
+    printf("Receiver performed %lu actions\n\n",
+           atomic_load(&receiver->actions));
+
+    for (int producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+        runBenchmark(producers, 0);
+        runBenchmark(producers, 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Coalescing invoker
+ * - Commands are queued before they are executed, and adjacent commands that
+ *   can be folded into one are merged while they wait. A burst of redundant
+ *   requests then costs a single call into the receiver.
+ */
+
+/**
+ * Every command type may declare a merge rule. `merge(into, next)` either
+ * folds `next` into `into` and returns 1, or returns 0 if the two cannot be
+ * combined. Only a command and the one submitted right after it are ever
+ * merged, so the order in which the receiver sees the effects is unchanged.
+ *
+ * The invoker holds up to `window` pending commands. It executes them when the
+ * window is full or when the client flushes it.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * The receiver owns some fields. Every change it applies has a noticeable
+ * cost, standing in for a write to a database, a network round trip or a
+ * redraw.
+ */
+#define NUM_FIELDS 64
+#define WORK_PER_ACTION 200
+
+typedef struct Receiver_s {
+    int64_t fields[NUM_FIELDS];
+    unsigned long actions;
+    volatile unsigned long sink;
+} Receiver_t;
+
+static void receiverWork(Receiver_t *receiver)
+{
+    for (int k = 0; k < WORK_PER_ACTION; k++) {
+        receiver->sink += (unsigned long) k;
+    }
+    receiver->actions++;
+}
+
+void receiverSet(Receiver_t *receiver, int field, int64_t value)
+{
+    receiverWork(receiver);
+    receiver->fields[field] = value;
+}
+
+void receiverAdd(Receiver_t *receiver, int field, int64_t delta)
+{
+    receiverWork(receiver);
+    receiver->fields[field] += delta;
+}
+
+Receiver_t * newReceiver(void)
+{
+    return (Receiver_t *) calloc(1, sizeof(Receiver_t));
+}
+
+typedef struct Command_s {
+    Receiver_t *receiver;
+    int field;
+    int64_t value;
+
+    void (*execute)(struct Command_s *command);
+    int (*merge)(struct Command_s *into, const struct Command_s *next);
+} Command_t;
+
+void setExecute(Command_t *c)
+{
+    receiverSet(c->receiver, c->field, c->value);
+}
+
+void addExecute(Command_t *c)
+{
+    receiverAdd(c->receiver, c->field, c->value);
+}
+
+/*
+ * Merge rules
+ *
+ *   set f = a ; set f = b   ->  set f = b
+ *   set f = a ; add f += d  ->  set f = a + d
+ *   add f += a ; add f += b ->  add f += a + b
+ *
+ * Anything else, including any two commands on different fields, stays
+ * separate.
+ */
+int setMerge(Command_t *into, const Command_t *next)
+{
+    if (into->receiver != next->receiver || into->field != next->field) {
+        return 0;
+    }
+
+    if (next->execute == setExecute) {
+        into->value = next->value;
+        return 1;
+    }
+
+    if (next->execute == addExecute) {
+        into->value += next->value;
+        return 1;
+    }
+
+    return 0;
+}
+
+int addMerge(Command_t *into, const Command_t *next)
+{
+    if (into->receiver != next->receiver || into->field != next->field) {
+        return 0;
+    }
+
+    if (next->execute == addExecute) {
+        into->value += next->value;
+        return 1;
+    }
+
+    /* a set after an add makes the add irrelevant */
+    if (next->execute == setExecute) {
+        *into = *next;
+        return 1;
+    }
+
+    return 0;
+}
+
+Command_t setCommand(Receiver_t *receiver, int field, int64_t value)
+{
+    Command_t c = { receiver, field, value, setExecute, setMerge };
+
+    return c;
+}
+
+Command_t addCommand(Receiver_t *receiver, int field, int64_t delta)
+{
+    Command_t c = { receiver, field, delta, addExecute, addMerge };
+
+    return c;
+}
+
+/*
+ * Invoker
+ */
+typedef struct Invoker_s {
+    Command_t *pending;
+    size_t count;
+    size_t window;
+    int coalesce;
+
+    unsigned long submitted;
+    unsigned long executed;
+
+    void (*storeCommand)(struct Invoker_s *invoker, const Command_t *command);
+    void (*flush)(struct Invoker_s *invoker);
+} Invoker_t;
+
+void invokerFlush(Invoker_t *invoker)
+{
+    for (size_t k = 0; k < invoker->count; k++) {
+        invoker->pending[k].execute(&invoker->pending[k]);
+    }
+
+    invoker->executed += invoker->count;
+    invoker->count = 0;
+}
+
+void invokerStoreCommand(Invoker_t *invoker, const Command_t *command)
+{
+    invoker->submitted++;
+
+    if (invoker->coalesce && invoker->count > 0) {
+        Command_t *last = &invoker->pending[invoker->count - 1];
+
+        if (last->merge && last->merge(last, command)) {
+            return;
+        }
+    }
+
+    if (invoker->count == invoker->window) {
+        invokerFlush(invoker);
+    }
+
+    invoker->pending[invoker->count++] = *command;
+}
+
+Invoker_t * newInvoker(size_t window, int coalesce)
+{
+    Invoker_t *invoker = (Invoker_t *) calloc(1, sizeof(Invoker_t));
+
+    invoker->pending = (Command_t *) malloc(window * sizeof(Command_t));
+    invoker->window = window;
+    invoker->coalesce = coalesce;
+
+    invoker->storeCommand = invokerStoreCommand;
+    invoker->flush = invokerFlush;
+
+    return invoker;
+}
+
+/*
+ * Benchmark
+ *
+ * A bursty producer: each burst picks one field and hammers it with a run of
+ * increments, sometimes starting with a set, before moving on to another
+ * field.
+ */
+#define BENCH_COMMANDS 2000000
+#define BENCH_WINDOW 256
+
+static void runBenchmark(int coalesce, Receiver_t *receiver)
+{
+    Invoker_t *invoker = newInvoker(BENCH_WINDOW, coalesce);
+    unsigned seed = 3;
+    uint64_t start = nowNs();
+
+    for (unsigned long sent = 0; sent < BENCH_COMMANDS; ) {
+        seed = seed * 1103515245u + 12345u;
+
+        int field = (int) ((seed >> 8) % NUM_FIELDS);
+        unsigned burst = 1 + (seed >> 16) % 32;
+
+        for (unsigned k = 0; k < burst && sent < BENCH_COMMANDS; k++, sent++) {
+            Command_t c = k == 0 && seed % 4 == 0
+                          ? setCommand(receiver, field, (int64_t) burst)
+                          : addCommand(receiver, field, (int64_t) k);
+
+            invoker->storeCommand(invoker, &c);
+        }
+    }
+
+    invoker->flush(invoker);
+
+    uint64_t elapsed = nowNs() - start;
+
+    printf("%-17s %8lu submitted %8lu executed  %7.1f ms\n",
+           coalesce ? "with coalescing" : "without", invoker->submitted,
+           invoker->executed, elapsed / 1e6);
+}
+
+int main(void)
+{
+    Receiver_t *receiver = newReceiver();
+    Invoker_t *invoker = newInvoker(8, 1);
+    Command_t c;
+
+    /* five commands on field 0 fold into a single set */
+    c = setCommand(receiver, 0, 10);
+    invoker->storeCommand(invoker, &c);
+    for (int k = 0; k < 4; k++) {
+        c = addCommand(receiver, 0, 1);
+        invoker->storeCommand(invoker, &c);
+    }
+    c = addCommand(receiver, 1, 7);
+    invoker->storeCommand(invoker, &c);
+    invoker->flush(invoker);
+
+    printf("field 0 = %lld, field 1 = %lld, %lu submitted, %lu executed\n\n",
+           (long long) receiver->fields[0], (long long) receiver->fields[1],
+           invoker->submitted, invoker->executed);
+
+    Receiver_t *plain = newReceiver();
+    Receiver_t *coalesced = newReceiver();
+
+    runBenchmark(0, plain);
+    runBenchmark(1, coalesced);
+
+    printf("receiver state %s\n",
+           memcmp(plain->fields, coalesced->fields, sizeof(plain->fields)) == 0
+           ? "identical" : "DIFFERS");
+
+    return 0;
+}
@@ -0,0 +1,622 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Command journal
+ * - Logging changes so that they can be reapplied in case of a system crash.
+ *   The Command interface is augmented with load and store operations, every
+ *   command is appended to a journal before it is executed, and recovering
+ *   from a crash means reloading the logged commands and executing them again.
+ */
+
+/**
+ * Each journal record is a small header followed by the command's stored
+ * payload:
+ *
+ *   | length (u32) | checksum (u32) | type (u16) | reserved (u16) | payload |
+ *
+ * A command is only executed once its record is durable. Making a record
+ * durable costs an fdatasync, so commits from many threads are grouped: the
+ * first thread to find no flush in progress becomes the leader and writes and
+ * syncs everything appended so far, while the others wait for it. While the
+ * leader is syncing, new commits collect in a second buffer and form the next
+ * group. Once the group is durable the leader also executes its commands, in
+ * the order they were appended, so the live state goes through exactly the
+ * sequence of commands that a replay of the journal will.
+ *
+ * Recovery maps the journal with mmap and walks it record by record, stopping
+ * at the first torn or corrupt record, which is where the crash happened. The
+ * torn tail is cut off, so that the journal can be reopened and appended to.
+ *
+ * The journal lives in /tmp unless a path is given as the first argument. The
+ * replay benchmark uses a 64 MB journal by default. Set JOURNAL_REPLAY_MB=1024
+ * to replay a 1 GB one.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* i.e. The object that will execute a command's action */
+#define RECEIVER_SLOTS 1024
+typedef struct Receiver_s {
+    atomic_long values[RECEIVER_SLOTS];
+} Receiver_t;
+
+Receiver_t * newReceiver(void)
+{
+    Receiver_t *receiver = (Receiver_t *) malloc(sizeof(Receiver_t));
+
+    for (int k = 0; k < RECEIVER_SLOTS; k++) {
+        atomic_init(&receiver->values[k], 0);
+    }
+
+    return receiver;
+}
+
+/*
+ * Commands
+ *
+ * Every command type can store itself into a payload and be loaded back from
+ * one. The type id in the record header selects the loader.
+ */
+typedef enum {
+    COMMAND_SET = 1,
+    COMMAND_ADD,
+} CommandType_t;
+
+typedef struct Command_s {
+    CommandType_t type;
+    Receiver_t *receiver;
+    uint32_t slot;
+    int64_t operand;
+
+    void (*execute)(struct Command_s *command);
+    size_t (*store)(struct Command_s *command, unsigned char *payload);
+} Command_t;
+
+#define PAYLOAD_SIZE (sizeof(uint32_t) + sizeof(int64_t))
+
+void setExecute(Command_t *command)
+{
+    atomic_store(&command->receiver->values[command->slot], command->operand);
+}
+
+void addExecute(Command_t *command)
+{
+    atomic_fetch_add(&command->receiver->values[command->slot],
+                     command->operand);
+}
+
+size_t commandStore(Command_t *command, unsigned char *payload)
+{
+    memcpy(payload, &command->slot, sizeof(uint32_t));
+    memcpy(payload + sizeof(uint32_t), &command->operand, sizeof(int64_t));
+
+    return PAYLOAD_SIZE;
+}
+
+void initCommand(Command_t *command, CommandType_t type, Receiver_t *receiver,
+                 uint32_t slot, int64_t operand)
+{
+    command->type = type;
+    command->receiver = receiver;
+    command->slot = slot % RECEIVER_SLOTS;
+    command->operand = operand;
+    command->execute = type == COMMAND_SET ? setExecute : addExecute;
+    command->store = commandStore;
+}
+
+/*
+ * Rebuild a command from its record. Returns 0 for an unknown type or a
+ * payload of the wrong size.
+ */
+int commandLoad(Command_t *command, uint16_t type, Receiver_t *receiver,
+                const unsigned char *payload, size_t len)
+{
+    uint32_t slot;
+    int64_t operand;
+
+    if ((type != COMMAND_SET && type != COMMAND_ADD) || len != PAYLOAD_SIZE) {
+        return 0;
+    }
+
+    memcpy(&slot, payload, sizeof(uint32_t));
+    memcpy(&operand, payload + sizeof(uint32_t), sizeof(int64_t));
+
+    initCommand(command, (CommandType_t) type, receiver, slot, operand);
+
+    return 1;
+}
+
+/*
+ * Journal
+ */
+typedef struct RecordHeader_s {
+    uint32_t length;
+    uint32_t checksum;
+    uint16_t type;
+    uint16_t reserved;
+} RecordHeader_t;
+
+#define RECORD_SIZE (sizeof(RecordHeader_t) + PAYLOAD_SIZE)
+
+/* FNV-1a, continuing from h */
+static uint32_t checksum(uint32_t h, const unsigned char *p, size_t len)
+{
+    for (size_t k = 0; k < len; k++) {
+        h = (h ^ p[k]) * 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * The checksum covers the header as well as the payload, hashed with the
+ * checksum field zeroed, so a corrupt type or length is caught too.
+ */
+static uint32_t recordChecksum(RecordHeader_t header, const unsigned char *payload)
+{
+    header.checksum = 0;
+
+    return checksum(checksum(2166136261u, (const unsigned char *) &header,
+                             sizeof(header)),
+                    payload, header.length);
+}
+
+static size_t encodeRecord(Command_t *command, unsigned char *out)
+{
+    RecordHeader_t header;
+    size_t len = command->store(command, out + sizeof(header));
+
+    header.length = (uint32_t) len;
+    header.type = (uint16_t) command->type;
+    header.reserved = 0;
+    header.checksum = recordChecksum(header, out + sizeof(header));
+    memcpy(out, &header, sizeof(header));
+
+    return sizeof(header) + len;
+}
+
+#define GROUP_BUFFER (1u << 20)
+#define GROUP_RECORDS (GROUP_BUFFER / RECORD_SIZE)
+
+typedef struct Journal_s {
+    int fd;
+
+    pthread_mutex_t lock;
+    pthread_cond_t durable;
+
+    unsigned char *buf;      /* records appended since the last flush */
+    unsigned char *spare;    /* the buffer being written by the leader */
+    size_t used;
+
+    /* the commands behind those records, in the same order */
+    Command_t **commands;
+    Command_t **spareCommands;
+    size_t numCommands;
+
+    uint64_t appended;       /* number of records appended so far */
+    uint64_t synced;         /* records [0, synced) are on disk */
+    int flushing;
+
+    unsigned long groups;
+
+    void (*commit)(struct Journal_s *journal, Command_t *command);
+} Journal_t;
+
+static int writeAll(int fd, const unsigned char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        p += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+/*
+ * Append the command and return once it is durable and executed. Commands are
+ * executed by the leader of their group, in journal order.
+ */
+void journalCommit(Journal_t *journal, Command_t *command)
+{
+    pthread_mutex_lock(&journal->lock);
+
+    /* the open group is full, wait for the leader to take it */
+    while (journal->used + RECORD_SIZE > GROUP_BUFFER) {
+        pthread_cond_wait(&journal->durable, &journal->lock);
+    }
+
+    journal->used += encodeRecord(command, journal->buf + journal->used);
+    journal->commands[journal->numCommands++] = command;
+    uint64_t mine = ++journal->appended;
+
+    while (journal->synced < mine) {
+        if (journal->flushing) {
+            pthread_cond_wait(&journal->durable, &journal->lock);
+            continue;
+        }
+
+        /* become the leader for everything appended so far */
+        unsigned char *group = journal->buf;
+        Command_t **commands = journal->commands;
+        size_t len = journal->used;
+        size_t numCommands = journal->numCommands;
+        uint64_t upto = journal->appended;
+
+        journal->buf = journal->spare;
+        journal->spare = group;
+        journal->commands = journal->spareCommands;
+        journal->spareCommands = commands;
+        journal->used = 0;
+        journal->numCommands = 0;
+        journal->flushing = 1;
+
+        pthread_mutex_unlock(&journal->lock);
+
+        if (writeAll(journal->fd, group, len) < 0
+            || fdatasync(journal->fd) < 0) {
+            perror("journal");
+            exit(1);
+        }
+
+        /* their committers are all still waiting, so the commands are valid */
+        for (size_t k = 0; k < numCommands; k++) {
+            commands[k]->execute(commands[k]);
+        }
+
+        pthread_mutex_lock(&journal->lock);
+
+        journal->synced = upto;
+        journal->flushing = 0;
+        journal->groups++;
+        pthread_cond_broadcast(&journal->durable);
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+}
+
+Journal_t * newJournal(const char *path)
+{
+    Journal_t *journal = (Journal_t *) calloc(1, sizeof(Journal_t));
+
+    /* append to what is there, e.g. a journal that was just recovered */
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal->fd < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->durable, NULL);
+    journal->buf = (unsigned char *) malloc(GROUP_BUFFER);
+    journal->spare = (unsigned char *) malloc(GROUP_BUFFER);
+    journal->commands = (Command_t **) malloc(GROUP_RECORDS * sizeof(Command_t *));
+    journal->spareCommands = (Command_t **) malloc(GROUP_RECORDS * sizeof(Command_t *));
+    journal->commit = journalCommit;
+
+    return journal;
+}
+
+void closeJournal(Journal_t *journal)
+{
+    close(journal->fd);
+    free(journal->buf);
+    free(journal->spare);
+    free(journal->commands);
+    free(journal->spareCommands);
+    free(journal);
+}
+
+/*
+ * Recovery: map the journal, re-execute every intact record on receiver and
+ * cut off a torn tail. Returns the number of commands replayed.
+ */
+uint64_t journalReplay(const char *path, Receiver_t *receiver)
+{
+    int fd = open(path, O_RDWR);
+    struct stat st;
+    uint64_t replayed = 0;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    const unsigned char *base = (const unsigned char *)
+        mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    /* the whole file is read front to back exactly once */
+    posix_madvise((void *) base, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    size_t off = 0;
+    size_t size = (size_t) st.st_size;
+
+    while (off + sizeof(RecordHeader_t) <= size) {
+        RecordHeader_t header;
+        Command_t command;
+
+        memcpy(&header, base + off, sizeof(header));
+
+        const unsigned char *payload = base + off + sizeof(header);
+
+        if (header.length > size - off - sizeof(header)
+            || recordChecksum(header, payload) != header.checksum
+            || !commandLoad(&command, header.type, receiver, payload,
+                            header.length)) {
+            break; /* torn tail: the crash happened here */
+        }
+
+        command.execute(&command);
+        replayed++;
+        off += sizeof(header) + header.length;
+    }
+
+    munmap((void *) base, size);
+
+    if (off < size && (ftruncate(fd, (off_t) off) < 0 || fdatasync(fd) < 0)) {
+        perror(path);
+        exit(1);
+    }
+    close(fd);
+
+    return replayed;
+}
+
+/*
+ * Benchmarks
+ */
+#define COMMITS_PER_THREAD 2000
+#define MAX_COMMITTERS 64
+
+typedef struct Committer_s {
+    Journal_t *journal;
+    Receiver_t *receiver;
+    int id;
+    CommandType_t type;
+    int commits;
+} Committer_t;
+
+static void * committerThread(void *arg)
+{
+    Committer_t *c = (Committer_t *) arg;
+
+    for (int k = 0; k < c->commits; k++) {
+        Command_t command;
+
+        /* SETs all go to slot 0 and differ per thread, ADDs are spread out */
+        if (c->type == COMMAND_SET) {
+            initCommand(&command, COMMAND_SET, c->receiver, 0, c->id * 1000 + k);
+        } else {
+            initCommand(&command, COMMAND_ADD, c->receiver,
+                        (uint32_t) (c->id * 31 + k), 1);
+        }
+        c->journal->commit(c->journal, &command);
+    }
+
+    return NULL;
+}
+
+static void benchGroupCommit(const char *path, int threads)
+{
+    unlink(path);
+
+    Journal_t *journal = newJournal(path);
+    Receiver_t *receiver = newReceiver();
+    pthread_t tids[MAX_COMMITTERS];
+    Committer_t args[MAX_COMMITTERS];
+    uint64_t start = nowNs();
+
+    for (int t = 0; t < threads; t++) {
+        args[t].journal = journal;
+        args[t].receiver = receiver;
+        args[t].id = t;
+        args[t].type = COMMAND_ADD;
+        args[t].commits = COMMITS_PER_THREAD;
+        pthread_create(&tids[t], NULL, committerThread, &args[t]);
+    }
+
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    uint64_t elapsed = nowNs() - start;
+    unsigned long commits = (unsigned long) threads * COMMITS_PER_THREAD;
+
+    printf("%2d committer(s) %9.0f commits/s  %6lu fdatasyncs  "
+           "mean group %6.1f\n", threads, commits / (elapsed / 1e9),
+           journal->groups, (double) commits / journal->groups);
+
+    closeJournal(journal);
+}
+
+static void benchReplay(const char *path, size_t megabytes)
+{
+    /* build the journal with large unsynced writes, only replay is timed */
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    unsigned char *chunk = (unsigned char *) malloc(GROUP_BUFFER);
+    Receiver_t *scratch = newReceiver();
+    uint64_t records = 0;
+    size_t target = megabytes << 20;
+
+    for (size_t written = 0; written < target; ) {
+        size_t used = 0;
+
+        while (used + RECORD_SIZE <= GROUP_BUFFER) {
+            Command_t command;
+
+            initCommand(&command, records & 1 ? COMMAND_ADD : COMMAND_SET,
+                        scratch, (uint32_t) records, (int64_t) records);
+            used += encodeRecord(&command, chunk + used);
+            records++;
+        }
+
+        writeAll(fd, chunk, used);
+        written += used;
+    }
+
+    close(fd);
+    free(chunk);
+
+    Receiver_t *receiver = newReceiver();
+    uint64_t start = nowNs();
+    uint64_t replayed = journalReplay(path, receiver);
+    uint64_t elapsed = nowNs() - start;
+
+    printf("replayed %llu commands from %zu MB in %.2f s  (%.0f MB/s, "
+           "%.1f M commands/s)%s\n", (unsigned long long) replayed, megabytes,
+           elapsed / 1e9, megabytes / (elapsed / 1e9),
+           replayed / (elapsed / 1e3), replayed == records ? "" : "  (SHORT)");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "/tmp/command-journal.log";
+    const char *replayMb = getenv("JOURNAL_REPLAY_MB");
+
+    /*
+     * Run a few commands through the journal, then "crash" and recover them
+     * into a fresh receiver.
+     */
+    unlink(path);
+
+    Journal_t *journal = newJournal(path);
+    Receiver_t *receiver = newReceiver();
+    Command_t command;
+
+    initCommand(&command, COMMAND_SET, receiver, 7, 40);
+    journal->commit(journal, &command);
+    initCommand(&command, COMMAND_ADD, receiver, 7, 2);
+    journal->commit(journal, &command);
+    closeJournal(journal);
+
+    /* simulate a crash in the middle of writing a third record */
+    int fd = open(path, O_WRONLY | O_APPEND);
+    unsigned char torn[RECORD_SIZE];
+    initCommand(&command, COMMAND_SET, receiver, 7, 0);
+    encodeRecord(&command, torn);
+    writeAll(fd, torn, RECORD_SIZE / 2);
+    close(fd);
+
+    Receiver_t *recovered = newReceiver();
+    uint64_t replayed = journalReplay(path, recovered);
+
+    printf("Live value %ld, recovered value %ld after replaying %llu commands\n",
+           atomic_load(&receiver->values[7]), atomic_load(&recovered->values[7]),
+           (unsigned long long) replayed);
+
+    /* carry on with the recovered journal, then recover again */
+    journal = newJournal(path);
+    initCommand(&command, COMMAND_ADD, recovered, 7, 100);
+    journal->commit(journal, &command);
+    closeJournal(journal);
+
+    Receiver_t *again = newReceiver();
+
+    replayed = journalReplay(path, again);
+    printf("Live value %ld, recovered value %ld after reopening and replaying"
+           " %llu commands\n", atomic_load(&recovered->values[7]),
+           atomic_load(&again->values[7]), (unsigned long long) replayed);
+
+    /* turn the ADD in the middle of three records into a SET */
+    unlink(path);
+    journal = newJournal(path);
+    receiver = newReceiver();
+    initCommand(&command, COMMAND_SET, receiver, 7, 40);
+    journal->commit(journal, &command);
+    initCommand(&command, COMMAND_ADD, receiver, 7, 2);
+    journal->commit(journal, &command);
+    initCommand(&command, COMMAND_ADD, receiver, 7, 1);
+    journal->commit(journal, &command);
+    closeJournal(journal);
+
+    uint16_t flipped = COMMAND_SET;
+
+    fd = open(path, O_WRONLY);
+    if (pwrite(fd, &flipped, sizeof(flipped),
+               (off_t) (RECORD_SIZE + offsetof(RecordHeader_t, type)))
+        != (ssize_t) sizeof(flipped)) {
+        perror(path);
+        exit(1);
+    }
+    close(fd);
+
+    recovered = newReceiver();
+    replayed = journalReplay(path, recovered);
+    printf("Corrupt type in record 2: recovered value %ld after replaying"
+           " %llu commands\n", atomic_load(&recovered->values[7]),
+           (unsigned long long) replayed);
+
+    /* racing SETs on one slot: the live state must match the journal's order */
+    unlink(path);
+    journal = newJournal(path);
+    receiver = newReceiver();
+
+    pthread_t tids[4];
+    Committer_t setters[4];
+
+    for (int t = 0; t < 4; t++) {
+        setters[t] = (Committer_t) { journal, receiver, t, COMMAND_SET, 200 };
+        pthread_create(&tids[t], NULL, committerThread, &setters[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    closeJournal(journal);
+
+    recovered = newReceiver();
+    journalReplay(path, recovered);
+
+    int same = 1;
+
+    for (int k = 0; k < RECEIVER_SLOTS; k++) {
+        same &= atomic_load(&receiver->values[k]) == atomic_load(&recovered->values[k]);
+    }
+    printf("4 threads racing SETs: live state %s the replayed state\n\n",
+           same ? "matches" : "DIFFERS FROM");
+
+    for (int threads = 1; threads <= MAX_COMMITTERS; threads *= 4) {
+        benchGroupCommit(path, threads);
+    }
+
+    printf("\n");
+    benchReplay(path, replayMb ? (size_t) atol(replayMb) : 64);
+
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,448 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Parallel invoker
+ * - Commands that touch different receivers are independent and can run at
+ *   the same time. Every command declares which receivers it reads and which
+ *   it writes, and the invoker runs non-conflicting commands concurrently on a
+ *   pool of worker threads.
+ */
+
+/**
+ * Two commands conflict when one writes a receiver the other reads or writes.
+ * Conflicting commands run in submission order, exactly as a serial invoker
+ * would run them. Non-conflicting ones may run in any order.
+ *
+ * For each batch the invoker walks the commands in order and keeps, for every
+ * receiver, the last command that wrote it and the commands that read it
+ * since then. A command waits for the last writer of everything it touches,
+ * and a writer additionally waits for those readers. That gives a dependency
+ * graph: commands with nothing to wait for are handed to the workers, and
+ * finishing a command releases the ones waiting on it.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Task_s Task_t;
+
+/* i.e. The object that will execute a command's action */
+typedef struct Receiver_s {
+    int64_t value;
+
+    /* bookkeeping while a batch is analysed */
+    Task_t *lastWriter;
+    Task_t **readers;
+    size_t numReaders, capReaders;
+} Receiver_t;
+
+Receiver_t * newReceivers(size_t n)
+{
+    return (Receiver_t *) calloc(n, sizeof(Receiver_t));
+}
+
+#define MAX_ACCESS 4
+
+typedef struct Command_s {
+    Receiver_t *reads[MAX_ACCESS];
+    int numReads;
+    Receiver_t *writes[MAX_ACCESS];
+    int numWrites;
+    int64_t operand;
+
+    void (*execute)(struct Command_s *command);
+} Command_t;
+
+/*
+ * A stand-in for real work: mixes the values it reads and stores the result
+ * in the receivers it writes.
+ */
+#define WORK_ROUNDS 4000
+
+void mixExecute(Command_t *c)
+{
+    uint64_t h = (uint64_t) c->operand;
+
+    for (int k = 0; k < c->numReads; k++) {
+        h ^= (uint64_t) c->reads[k]->value;
+    }
+
+    for (int r = 0; r < WORK_ROUNDS; r++) {
+        h = h * 6364136223846793005ull + 1442695040888963407ull;
+    }
+
+    for (int k = 0; k < c->numWrites; k++) {
+        c->writes[k]->value += (int64_t) (h >> 40);
+    }
+}
+
+/*
+ * Dependency graph
+ */
+struct Task_s {
+    Command_t *command;
+    atomic_int waitingFor;
+    Task_t **dependents;
+    size_t numDependents, capDependents;
+    Task_t *nextReady;
+};
+
+static void addDependency(Task_t *before, Task_t *after)
+{
+    if (before == after) {
+        return;
+    }
+
+    if (before->numDependents == before->capDependents) {
+        before->capDependents = before->capDependents ? 2 * before->capDependents : 4;
+        before->dependents = (Task_t **) realloc(before->dependents,
+            before->capDependents * sizeof(Task_t *));
+    }
+
+    before->dependents[before->numDependents++] = after;
+    atomic_fetch_add_explicit(&after->waitingFor, 1, memory_order_relaxed);
+}
+
+static void addReader(Receiver_t *r, Task_t *t)
+{
+    if (r->numReaders == r->capReaders) {
+        r->capReaders = r->capReaders ? 2 * r->capReaders : 4;
+        r->readers = (Task_t **) realloc(r->readers,
+                                         r->capReaders * sizeof(Task_t *));
+    }
+
+    r->readers[r->numReaders++] = t;
+}
+
+static void analyse(Task_t *tasks, size_t n)
+{
+    for (size_t k = 0; k < n; k++) {
+        Task_t *t = &tasks[k];
+        Command_t *c = t->command;
+
+        for (int j = 0; j < c->numReads; j++) {
+            Receiver_t *r = c->reads[j];
+
+            if (r->lastWriter) {
+                addDependency(r->lastWriter, t);
+            }
+            addReader(r, t);
+        }
+
+        for (int j = 0; j < c->numWrites; j++) {
+            Receiver_t *r = c->writes[j];
+
+            if (r->lastWriter) {
+                addDependency(r->lastWriter, t);
+            }
+            for (size_t i = 0; i < r->numReaders; i++) {
+                addDependency(r->readers[i], t);
+            }
+
+            r->lastWriter = t;
+            r->numReaders = 0;
+        }
+    }
+
+    /* leave the receivers clean for the next batch */
+    for (size_t k = 0; k < n; k++) {
+        Command_t *c = tasks[k].command;
+
+        for (int j = 0; j < c->numReads; j++) {
+            c->reads[j]->lastWriter = NULL;
+            c->reads[j]->numReaders = 0;
+        }
+        for (int j = 0; j < c->numWrites; j++) {
+            c->writes[j]->lastWriter = NULL;
+            c->writes[j]->numReaders = 0;
+        }
+    }
+}
+
+/*
+ * Parallel invoker
+ */
+#define MAX_WORKERS 16
+
+typedef struct ParallelInvoker_s {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+
+    Task_t *ready;           /* stack of runnable tasks */
+    size_t remaining;        /* tasks of the current batch not yet done */
+    int stopping;
+
+    int numWorkers;
+    pthread_t workers[MAX_WORKERS];
+
+    void (*executeBatch)(struct ParallelInvoker_s *invoker,
+                         Command_t **commands, size_t n);
+    void (*shutdown)(struct ParallelInvoker_s *invoker);
+} ParallelInvoker_t;
+
+static void * workerThread(void *arg)
+{
+    ParallelInvoker_t *invoker = (ParallelInvoker_t *) arg;
+
+    pthread_mutex_lock(&invoker->lock);
+
+    for (;;) {
+        while (!invoker->ready && !invoker->stopping) {
+            pthread_cond_wait(&invoker->work, &invoker->lock);
+        }
+
+        if (!invoker->ready) {
+            break;
+        }
+
+        Task_t *t = invoker->ready;
+        invoker->ready = t->nextReady;
+
+        pthread_mutex_unlock(&invoker->lock);
+
+        t->command->execute(t->command);
+
+        /* release whatever was waiting on this command */
+        Task_t *released = NULL;
+        int numReleased = 0;
+
+        for (size_t k = 0; k < t->numDependents; k++) {
+            Task_t *d = t->dependents[k];
+
+            if (atomic_fetch_sub(&d->waitingFor, 1) == 1) {
+                d->nextReady = released;
+                released = d;
+                numReleased++;
+            }
+        }
+
+        pthread_mutex_lock(&invoker->lock);
+
+        while (released) {
+            Task_t *next = released->nextReady;
+
+            released->nextReady = invoker->ready;
+            invoker->ready = released;
+            released = next;
+        }
+
+        if (numReleased > 1) {
+            pthread_cond_broadcast(&invoker->work);
+        } else if (numReleased == 1) {
+            pthread_cond_signal(&invoker->work);
+        }
+
+        if (--invoker->remaining == 0) {
+            pthread_cond_signal(&invoker->finished);
+        }
+    }
+
+    pthread_mutex_unlock(&invoker->lock);
+
+    return NULL;
+}
+
+/*
+ * Run a batch of commands and return once all of them have executed.
+ */
+void invokerExecuteBatch(ParallelInvoker_t *invoker, Command_t **commands,
+                         size_t n)
+{
+    Task_t *tasks = (Task_t *) calloc(n, sizeof(Task_t));
+
+    for (size_t k = 0; k < n; k++) {
+        tasks[k].command = commands[k];
+        atomic_init(&tasks[k].waitingFor, 0);
+    }
+
+    analyse(tasks, n);
+
+    pthread_mutex_lock(&invoker->lock);
+
+    invoker->remaining = n;
+
+    for (size_t k = n; k-- > 0; ) {
+        if (atomic_load(&tasks[k].waitingFor) == 0) {
+            tasks[k].nextReady = invoker->ready;
+            invoker->ready = &tasks[k];
+        }
+    }
+    pthread_cond_broadcast(&invoker->work);
+
+    while (invoker->remaining > 0) {
+        pthread_cond_wait(&invoker->finished, &invoker->lock);
+    }
+
+    pthread_mutex_unlock(&invoker->lock);
+
+    for (size_t k = 0; k < n; k++) {
+        free(tasks[k].dependents);
+    }
+    free(tasks);
+}
+
+void invokerShutdown(ParallelInvoker_t *invoker)
+{
+    pthread_mutex_lock(&invoker->lock);
+    invoker->stopping = 1;
+    pthread_cond_broadcast(&invoker->work);
+    pthread_mutex_unlock(&invoker->lock);
+
+    for (int k = 0; k < invoker->numWorkers; k++) {
+        pthread_join(invoker->workers[k], NULL);
+    }
+}
+
+ParallelInvoker_t * newParallelInvoker(int numWorkers)
+{
+    ParallelInvoker_t *invoker = (ParallelInvoker_t *)
+        calloc(1, sizeof(ParallelInvoker_t));
+
+    pthread_mutex_init(&invoker->lock, NULL);
+    pthread_cond_init(&invoker->work, NULL);
+    pthread_cond_init(&invoker->finished, NULL);
+
+    invoker->executeBatch = invokerExecuteBatch;
+    invoker->shutdown = invokerShutdown;
+
+    invoker->numWorkers = numWorkers;
+    for (int k = 0; k < numWorkers; k++) {
+        pthread_create(&invoker->workers[k], NULL, workerThread, invoker);
+    }
+
+    return invoker;
+}
+
+/*
+ * Benchmark
+ *
+ * Each command reads two receivers and writes one. With probability
+ * `conflictPercent` a receiver is drawn from a handful of hot receivers, so
+ * commands collide there. Otherwise it comes from a large cold set.
+ */
+#define NUM_RECEIVERS 4096
+#define NUM_HOT 4
+#define BENCH_COMMANDS 20000
+
+static Receiver_t * pickReceiver(Receiver_t *receivers, unsigned *seed,
+                                 int conflictPercent)
+{
+    *seed = *seed * 1103515245u + 12345u;
+
+    if ((int) ((*seed >> 8) % 100) < conflictPercent) {
+        return &receivers[(*seed >> 4) % NUM_HOT];
+    }
+
+    return &receivers[NUM_HOT + (*seed >> 4) % (NUM_RECEIVERS - NUM_HOT)];
+}
+
+static Command_t * makeWorkload(Receiver_t *receivers, int conflictPercent)
+{
+    Command_t *commands = (Command_t *) calloc(BENCH_COMMANDS, sizeof(Command_t));
+    unsigned seed = 11;
+
+    for (int k = 0; k < BENCH_COMMANDS; k++) {
+        Command_t *c = &commands[k];
+
+        c->reads[0] = pickReceiver(receivers, &seed, conflictPercent);
+        c->reads[1] = pickReceiver(receivers, &seed, conflictPercent);
+        c->numReads = 2;
+        c->writes[0] = pickReceiver(receivers, &seed, conflictPercent);
+        c->numWrites = 1;
+        c->operand = k;
+        c->execute = mixExecute;
+    }
+
+    return commands;
+}
+
+static int64_t receiverChecksum(Receiver_t *receivers)
+{
+    int64_t sum = 0;
+
+    for (int k = 0; k < NUM_RECEIVERS; k++) {
+        sum = sum * 31 + receivers[k].value;
+    }
+
+    return sum;
+}
+
+static void runBenchmark(int conflictPercent)
+{
+    Receiver_t *receivers = newReceivers(NUM_RECEIVERS);
+    Command_t *commands = makeWorkload(receivers, conflictPercent);
+    Command_t **batch = (Command_t **) malloc(BENCH_COMMANDS * sizeof(Command_t *));
+
+    for (int k = 0; k < BENCH_COMMANDS; k++) {
+        batch[k] = &commands[k];
+    }
+
+    /* the serial invoker defines the expected result */
+    uint64_t start = nowNs();
+    for (int k = 0; k < BENCH_COMMANDS; k++) {
+        commands[k].execute(&commands[k]);
+    }
+    uint64_t serialNs = nowNs() - start;
+    int64_t expected = receiverChecksum(receivers);
+
+    printf("conflicts %3d%%  serial %7.1f ms", conflictPercent, serialNs / 1e6);
+
+    for (int workers = 1; workers <= 8; workers *= 2) {
+        ParallelInvoker_t *invoker = newParallelInvoker(workers);
+
+        for (int k = 0; k < NUM_RECEIVERS; k++) {
+            receivers[k].value = 0;
+        }
+
+        start = nowNs();
+        invoker->executeBatch(invoker, batch, BENCH_COMMANDS);
+        uint64_t elapsed = nowNs() - start;
+
+        invoker->shutdown(invoker);
+
+        printf("  %dw %6.2fx%s", workers, (double) serialNs / elapsed,
+               receiverChecksum(receivers) == expected ? "" : " (WRONG)");
+    }
+
+    printf("\n");
+}
+
+int main(void)
+{
+    Receiver_t *receivers = newReceivers(3);
+    ParallelInvoker_t *invoker = newParallelInvoker(2);
+    Command_t a = { { &receivers[0] }, 1, { &receivers[1] }, 1, 1, mixExecute };
+    Command_t b = { { &receivers[2] }, 1, { &receivers[2] }, 1, 2, mixExecute };
+    Command_t c = { { &receivers[1] }, 1, { &receivers[0] }, 1, 3, mixExecute };
+    Command_t *batch[] = { &a, &b, &c };
+
+    /* a and b are independent, c reads what a writes and so runs after it */
+    invoker->executeBatch(invoker, batch, 3);
+    invoker->shutdown(invoker);
+    printf("Batch of 3 commands executed on 2 workers\n\n");
+
+    printf("speedup over the serial invoker by number of workers "
+           "(%ld cores online)\n", sysconf(_SC_NPROCESSORS_ONLN));
+    runBenchmark(0);
+    runBenchmark(10);
+    runBenchmark(50);
+    runBenchmark(100);
+
+    return 0;
+}
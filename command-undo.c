@@ -0,0 +1,445 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Undoable commands
+ * - The Command's execute operation stores state for reversing its effects,
+ *   and an added unexecute operation reverses them. Executed commands are
+ *   stored in a history list, and undo and redo traverse this list backwards
+ *   and forwards calling unexecute and execute, respectively.
+ */
+
+/**
+ * Keeping every executed Command_t alive would cost a heap object per edit.
+ * Instead the history stores each command as a packed record that holds just
+ * enough to execute and unexecute it again:
+ *
+ *   | type (1 byte) | index (varint) | operand(s) (zigzag varint) | length |
+ *
+ * The trailing length byte lets undo step backwards from the end of a record.
+ *
+ * Records are appended to fixed-size chunks held in a ring. The history has a
+ * byte budget: when a new chunk would exceed it, the oldest chunk is dropped,
+ * and with it the oldest undo steps. Executing a new command after some undos
+ * discards the redo steps past the cursor, as usual.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* i.e. The object that will execute a command's action */
+typedef struct Receiver_s {
+    int64_t *cells;
+    size_t numCells;
+} Receiver_t;
+
+Receiver_t * newReceiver(size_t numCells)
+{
+    Receiver_t *receiver = (Receiver_t *) malloc(sizeof(Receiver_t));
+
+    receiver->cells = (int64_t *) calloc(numCells, sizeof(int64_t));
+    receiver->numCells = numCells;
+
+    return receiver;
+}
+
+typedef enum {
+    COMMAND_SET = 1,  /* cells[index] = value, remembers the old value */
+    COMMAND_ADD,      /* cells[index] += value, its own inverse */
+} CommandType_t;
+
+typedef struct Command_s {
+    CommandType_t type;
+    Receiver_t *receiver;
+    uint32_t index;
+    int64_t value;
+    int64_t oldValue;  /* filled in by execute, used by unexecute */
+
+    void (*execute)(struct Command_s *command);
+    void (*unexecute)(struct Command_s *command);
+} Command_t;
+
+void setExecute(Command_t *c)
+{
+    c->oldValue = c->receiver->cells[c->index];
+    c->receiver->cells[c->index] = c->value;
+}
+
+void setUnexecute(Command_t *c)
+{
+    c->receiver->cells[c->index] = c->oldValue;
+}
+
+void addExecute(Command_t *c)
+{
+    c->receiver->cells[c->index] += c->value;
+}
+
+void addUnexecute(Command_t *c)
+{
+    c->receiver->cells[c->index] -= c->value;
+}
+
+void initCommand(Command_t *command, CommandType_t type, Receiver_t *receiver,
+                 uint32_t index, int64_t value)
+{
+    command->type = type;
+    command->receiver = receiver;
+    command->index = index;
+    command->value = value;
+    command->oldValue = 0;
+
+    if (type == COMMAND_SET) {
+        command->execute = setExecute;
+        command->unexecute = setUnexecute;
+    } else {
+        command->execute = addExecute;
+        command->unexecute = addUnexecute;
+    }
+}
+
+/*
+ * Packed records
+ */
+#define MAX_RECORD 32
+
+static size_t putVarint(unsigned char *p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char) v;
+
+    return n;
+}
+
+static size_t getVarint(const unsigned char *p, uint64_t *v)
+{
+    size_t n = 0;
+    unsigned shift = 0;
+
+    *v = 0;
+    do {
+        *v |= (uint64_t) (p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+
+    return n;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static size_t encodeRecord(const Command_t *c, unsigned char *p)
+{
+    size_t n = 0;
+
+    p[n++] = (unsigned char) c->type;
+    n += putVarint(p + n, c->index);
+    n += putVarint(p + n, zigzag(c->value));
+
+    if (c->type == COMMAND_SET) {
+        n += putVarint(p + n, zigzag(c->oldValue));
+    }
+
+    p[n] = (unsigned char) (n + 1);  /* total length, read by undo */
+
+    return n + 1;
+}
+
+/* Returns the length of the record, including its length byte */
+static size_t decodeRecord(const unsigned char *p, Command_t *c,
+                           Receiver_t *receiver)
+{
+    uint64_t index, value, oldValue;
+    size_t n = 1;
+
+    n += getVarint(p + n, &index);
+    n += getVarint(p + n, &value);
+
+    initCommand(c, (CommandType_t) p[0], receiver, (uint32_t) index,
+                unzigzag(value));
+
+    if (c->type == COMMAND_SET) {
+        n += getVarint(p + n, &oldValue);
+        c->oldValue = unzigzag(oldValue);
+    }
+
+    return n + 1;
+}
+
+/*
+ * History
+ */
+#define CHUNK_SIZE (64 * 1024)
+
+typedef struct Chunk_s {
+    size_t used;
+    unsigned char data[CHUNK_SIZE];
+} Chunk_t;
+
+typedef struct History_s {
+    Receiver_t *receiver;
+
+    Chunk_t **ring;      /* chunks, oldest at ring[first] */
+    size_t slots, first, count;
+    Chunk_t *spare;      /* a dropped chunk kept for reuse */
+
+    size_t curChunk;     /* cursor, relative to first */
+    size_t curOff;
+
+    size_t budget;
+    unsigned long long dropped;
+
+    void (*doCommand)(struct History_s *history, Command_t *command);
+    int (*undo)(struct History_s *history);
+    int (*redo)(struct History_s *history);
+} History_t;
+
+static Chunk_t * historyChunk(History_t *h, size_t k)
+{
+    return h->ring[(h->first + k) % h->slots];
+}
+
+static size_t countRecords(const Chunk_t *chunk)
+{
+    size_t records = 0;
+
+    for (size_t off = chunk->used; off > 0; off -= chunk->data[off - 1]) {
+        records++;
+    }
+
+    return records;
+}
+
+static void historyAddChunk(History_t *h)
+{
+    /* over budget: forget the oldest undo steps */
+    while (h->count > 0 && (h->count + 1) * sizeof(Chunk_t) > h->budget) {
+        Chunk_t *oldest = historyChunk(h, 0);
+
+        h->dropped += countRecords(oldest);
+        free(h->spare);
+        h->spare = oldest;
+        h->first = (h->first + 1) % h->slots;
+        h->count--;
+        h->curChunk--;
+    }
+
+    Chunk_t *chunk = h->spare ? h->spare : (Chunk_t *) malloc(sizeof(Chunk_t));
+
+    h->spare = NULL;
+    chunk->used = 0;
+    h->ring[(h->first + h->count) % h->slots] = chunk;
+    h->count++;
+
+    h->curChunk = h->count - 1;
+    h->curOff = 0;
+}
+
+/*
+ * Execute a command and remember how to reverse it.
+ */
+void historyDoCommand(History_t *h, Command_t *command)
+{
+    command->execute(command);
+
+    /* a new command invalidates everything that could have been redone */
+    while (h->count > h->curChunk + 1) {
+        free(historyChunk(h, h->count - 1));
+        h->count--;
+    }
+    historyChunk(h, h->curChunk)->used = h->curOff;
+
+    if (h->curOff + MAX_RECORD > CHUNK_SIZE) {
+        historyAddChunk(h);
+    }
+
+    Chunk_t *chunk = historyChunk(h, h->curChunk);
+
+    h->curOff += encodeRecord(command, chunk->data + h->curOff);
+    chunk->used = h->curOff;
+}
+
+int historyUndo(History_t *h)
+{
+    if (h->curOff == 0) {
+        if (h->curChunk == 0) {
+            return 0; /* nothing left to undo */
+        }
+        h->curChunk--;
+        h->curOff = historyChunk(h, h->curChunk)->used;
+    }
+
+    Chunk_t *chunk = historyChunk(h, h->curChunk);
+    Command_t command;
+
+    h->curOff -= chunk->data[h->curOff - 1];
+    decodeRecord(chunk->data + h->curOff, &command, h->receiver);
+    command.unexecute(&command);
+
+    return 1;
+}
+
+int historyRedo(History_t *h)
+{
+    Chunk_t *chunk = historyChunk(h, h->curChunk);
+
+    if (h->curOff == chunk->used) {
+        if (h->curChunk + 1 == h->count) {
+            return 0; /* nothing left to redo */
+        }
+        h->curChunk++;
+        h->curOff = 0;
+        chunk = historyChunk(h, h->curChunk);
+    }
+
+    Command_t command;
+
+    h->curOff += decodeRecord(chunk->data + h->curOff, &command, h->receiver);
+    command.execute(&command);
+
+    return 1;
+}
+
+History_t * newHistory(Receiver_t *receiver, size_t budget)
+{
+    History_t *h = (History_t *) calloc(1, sizeof(History_t));
+
+    h->receiver = receiver;
+    h->budget = budget < 2 * sizeof(Chunk_t) ? 2 * sizeof(Chunk_t) : budget;
+    h->slots = h->budget / sizeof(Chunk_t) + 1;
+    h->ring = (Chunk_t **) calloc(h->slots, sizeof(Chunk_t *));
+
+    h->doCommand = historyDoCommand;
+    h->undo = historyUndo;
+    h->redo = historyRedo;
+
+    historyAddChunk(h);
+
+    return h;
+}
+
+size_t historyBytes(History_t *h)
+{
+    return h->count * sizeof(Chunk_t);
+}
+
+/*
+ * Benchmark
+ */
+#define NUM_CELLS (1u << 20)
+
+static int64_t cellSum(Receiver_t *receiver)
+{
+    int64_t sum = 0;
+
+    for (size_t k = 0; k < receiver->numCells; k++) {
+        sum += receiver->cells[k] * (int64_t) (k + 1);
+    }
+
+    return sum;
+}
+
+static void runBenchmark(size_t edits, size_t budget)
+{
+    Receiver_t *receiver = newReceiver(NUM_CELLS);
+    History_t *history = newHistory(receiver, budget);
+    unsigned seed = 7;
+    size_t undone = 0, redone = 0;
+
+    uint64_t start = nowNs();
+
+    for (size_t k = 0; k < edits; k++) {
+        Command_t command;
+
+        seed = seed * 1103515245u + 12345u;
+
+        /* mostly small increments, sometimes an overwrite */
+        if (seed % 8 == 0) {
+            initCommand(&command, COMMAND_SET, receiver,
+                        (seed >> 8) % NUM_CELLS, (int64_t) (seed >> 4));
+        } else {
+            initCommand(&command, COMMAND_ADD, receiver,
+                        (seed >> 8) % NUM_CELLS, (int64_t) (seed % 16) - 8);
+        }
+
+        history->doCommand(history, &command);
+    }
+
+    uint64_t doNs = nowNs() - start;
+    int64_t afterDo = cellSum(receiver);
+
+    start = nowNs();
+    while (history->undo(history)) {
+        undone++;
+    }
+    uint64_t undoNs = nowNs() - start;
+    int64_t undoneSum = cellSum(receiver);
+
+    start = nowNs();
+    while (history->redo(history)) {
+        redone++;
+    }
+    uint64_t redoNs = nowNs() - start;
+    int mismatch = cellSum(receiver) != afterDo
+                   || (history->dropped == 0 && undoneSum != 0);
+
+    printf("%5zu M edits, budget %4zu MB: %9zu kept, %9llu dropped, "
+           "%5.2f bytes/command\n", edits / 1000000, budget >> 20, undone,
+           history->dropped, (double) historyBytes(history) / undone);
+    printf("    do %6.1f M/s   undo %6.1f M/s   redo %6.1f M/s%s\n",
+           edits / (doNs / 1e3), undone / (undoNs / 1e3),
+           redone / (redoNs / 1e3), mismatch ? "  (STATE MISMATCH)" : "");
+}
+
+int main(void)
+{
+    Receiver_t *receiver = newReceiver(4);
+    History_t *history = newHistory(receiver, 0);
+    Command_t command;
+
+    initCommand(&command, COMMAND_SET, receiver, 0, 10);
+    history->doCommand(history, &command);
+    initCommand(&command, COMMAND_ADD, receiver, 0, 5);
+    history->doCommand(history, &command);
+    printf("After set 10, add 5:  %lld\n", (long long) receiver->cells[0]);
+
+    history->undo(history);
+    printf("Undo:                 %lld\n", (long long) receiver->cells[0]);
+    history->undo(history);
+    printf("Undo:                 %lld\n", (long long) receiver->cells[0]);
+    history->redo(history);
+    printf("Redo:                 %lld\n", (long long) receiver->cells[0]);
+    history->redo(history);
+    printf("Redo:                 %lld\n\n", (long long) receiver->cells[0]);
+
+    printf("A heap-allocated Command_t per edit would cost at least %zu "
+           "bytes/command\n\n", sizeof(Command_t) + sizeof(Command_t *));
+
+    runBenchmark(10000000, 256u << 20);
+    runBenchmark(10000000, 16u << 20);
+
+    return 0;
+}
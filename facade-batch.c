@@ -0,0 +1,379 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+/**
+ * Batch facade
+ * - The facade's single high-level operation also comes in a batch form that
+ *   squares and displays a whole array in one call. Clients that push
+ *   millions of values through the facade use the batch form. Everybody else
+ *   keeps using the simple one.
+ */
+
+/**
+ * The batch operation
+ * - squares the values with SIMD, widening every value to 64 bits first so
+ *   that squares of large ints do not overflow (AVX2 or SSE4.1, picked at run
+ *   time, with a scalar fallback),
+ * - formats the results with an integer-to-ASCII routine that emits two
+ *   digits per step from a lookup table,
+ * - collects everything in one output buffer and hands it to the operating
+ *   system with a single write.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Facade_s Facade_t;
+typedef struct Subsystem_s Subsystem_t;
+
+/*
+ * Every subsystem has a per-value function and a batch function. The batch
+ * function consumes n inputs and returns how many output elements (values or
+ * bytes) it produced.
+ */
+struct Subsystem_s {
+    int (*subsystemFn)(int arg);
+    size_t (*batchFn)(const void *in, size_t n, void *out);
+};
+
+struct Facade_s {
+    Subsystem_t *squarer;
+    Subsystem_t *displayer;
+
+    void (*squareAndDisplay)(Facade_t *, int);
+    void (*squareAndDisplayBatch)(Facade_t *, const int32_t *, size_t, int fd);
+};
+
+/*
+ * Squarer subsystem, batch kernels
+ */
+void squareScalar(const int32_t *in, int64_t *out, size_t n)
+{
+    for (size_t k = 0; k < n; k++) {
+        out[k] = (int64_t) in[k] * in[k];
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse4.1")))
+void squareSse41(const int32_t *in, int64_t *out, size_t n)
+{
+    size_t k = 0;
+
+    for (; k + 2 <= n; k += 2) {
+        /* sign-extend two ints to two 64-bit lanes, then a signed 32x32->64 */
+        __m128i v = _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i *) (in + k)));
+
+        _mm_storeu_si128((__m128i *) (out + k), _mm_mul_epi32(v, v));
+    }
+
+    squareScalar(in + k, out + k, n - k);
+}
+
+__attribute__((target("avx2")))
+void squareAvx2(const int32_t *in, int64_t *out, size_t n)
+{
+    size_t k = 0;
+
+    for (; k + 8 <= n; k += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (in + k));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (in + k + 4));
+        __m256i a = _mm256_cvtepi32_epi64(lo);
+        __m256i b = _mm256_cvtepi32_epi64(hi);
+
+        _mm256_storeu_si256((__m256i *) (out + k), _mm256_mul_epi32(a, a));
+        _mm256_storeu_si256((__m256i *) (out + k + 4), _mm256_mul_epi32(b, b));
+    }
+
+    squareScalar(in + k, out + k, n - k);
+}
+#endif
+
+typedef void (*SquareFn_t)(const int32_t *, int64_t *, size_t);
+
+static SquareFn_t selectSquareKernel(const char **name)
+{
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return squareAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        *name = "sse4.1";
+        return squareSse41;
+    }
+#endif
+    *name = "scalar";
+    return squareScalar;
+}
+
+static SquareFn_t squareKernel;
+static const char *squareKernelName;
+
+size_t computeBatchOperation(const void *in, size_t n, void *out)
+{
+    squareKernel((const int32_t *) in, (int64_t *) out, n);
+
+    return n;
+}
+
+/*
+ * Displayer subsystem, batch formatting
+ */
+static const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+#define MAX_FORMATTED 21 /* sign, 19 digits and a newline */
+
+/*
+ * Write v followed by a newline at p, return the number of bytes written.
+ */
+size_t formatInt64(char *p, int64_t v)
+{
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *q = end;
+    uint64_t u = v < 0 ? 0 - (uint64_t) v : (uint64_t) v;
+    size_t n = 0;
+
+    while (u >= 100) {
+        unsigned pair = (unsigned) (u % 100) * 2;
+
+        u /= 100;
+        *--q = digitPairs[pair + 1];
+        *--q = digitPairs[pair];
+    }
+
+    if (u >= 10) {
+        *--q = digitPairs[u * 2 + 1];
+        *--q = digitPairs[u * 2];
+    } else {
+        *--q = (char) ('0' + u);
+    }
+
+    if (v < 0) {
+        p[n++] = '-';
+    }
+
+    memcpy(p + n, q, (size_t) (end - q));
+    n += (size_t) (end - q);
+    p[n++] = '\n';
+
+    return n;
+}
+
+size_t displayBatchOperation(const void *in, size_t n, void *out)
+{
+    const int64_t *values = (const int64_t *) in;
+    char *p = (char *) out;
+    size_t used = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        used += formatInt64(p + used, values[k]);
+    }
+
+    return used;
+}
+
+static int writeAll(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        p += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+/*
+ * Facade
+ */
+void facadeSquareAndDisplay(Facade_t *facade, int num)
+{
+    int result;
+
+    result = facade->squarer->subsystemFn(num);
+
+    facade->displayer->subsystemFn(result);
+}
+
+void facadeSquareAndDisplayBatch(Facade_t *facade, const int32_t *nums,
+                                 size_t n, int fd)
+{
+    int64_t *squares = (int64_t *) malloc(n * sizeof(int64_t));
+    char *out = (char *) malloc(n * MAX_FORMATTED);
+
+    facade->squarer->batchFn(nums, n, squares);
+
+    size_t used = facade->displayer->batchFn(squares, n, out);
+
+    writeAll(fd, out, used);
+
+    free(out);
+    free(squares);
+}
+
+Facade_t * newFacade(Subsystem_t *squarer, Subsystem_t *displayer)
+{
+    Facade_t *facade = (Facade_t *) malloc(sizeof(Facade_t));
+
+    facade->squarer = squarer;
+    facade->displayer = displayer;
+
+    facade->squareAndDisplay = facadeSquareAndDisplay;
+    facade->squareAndDisplayBatch = facadeSquareAndDisplayBatch;
+
+    if (!squareKernel) {
+        squareKernel = selectSquareKernel(&squareKernelName);
+    }
+
+    return facade;
+}
+
+Subsystem_t * newSubsystem(int (*subsystemFn)(int),
+                           size_t (*batchFn)(const void *, size_t, void *))
+{
+    Subsystem_t *subsystem = (Subsystem_t *) malloc(sizeof(Subsystem_t));
+
+    subsystem->subsystemFn = subsystemFn;
+    subsystem->batchFn = batchFn;
+
+    return subsystem;
+}
+
+int computeOperation(int arg)
+{
+    printf("Calling square operation\n");
+    return arg * arg;
+}
+
+int displayOperation(int arg)
+{
+    printf("Calling display operation\n");
+    printf("%d\n", arg);
+    return arg;
+}
+
+/*
+ * Check the batch path against printf on values that include the extremes,
+ * whose squares no longer fit in an int.
+ */
+static int checkBatchFormatting(void)
+{
+    const int32_t samples[] = { 0, 1, -1, 7, -46341, 46341, 99999, -100000,
+                                INT32_MAX, INT32_MIN };
+    size_t n = sizeof(samples) / sizeof(samples[0]);
+    int64_t squares[sizeof(samples) / sizeof(samples[0])];
+    char got[MAX_FORMATTED], want[32];
+    int bad = 0;
+
+    squareKernel(samples, squares, n);
+
+    for (size_t k = 0; k < n; k++) {
+        size_t len = formatInt64(got, squares[k]);
+
+        snprintf(want, sizeof(want), "%lld\n",
+                 (long long) samples[k] * samples[k]);
+
+        if (len != strlen(want) || memcmp(got, want, len) != 0) {
+            bad++;
+        }
+    }
+
+    return bad;
+}
+
+/*
+ * Benchmark: values/sec through the per-call facade and the batch facade, with
+ * the output going to /dev/null.
+ */
+#define BENCH_VALUES 2000000
+
+int main(void)
+{
+    Subsystem_t *squarer = newSubsystem(computeOperation, computeBatchOperation);
+    Subsystem_t *displayer = newSubsystem(displayOperation,
+                                          displayBatchOperation);
+    Facade_t *facade = newFacade(squarer, displayer);
+
+    int a = 7;
+    printf("%d x %d = ...\n", a, a);
+    facade->squareAndDisplay(facade, a);
+
+    int32_t batch[] = { 1, 2, 3, 65536 };
+    printf("Batch of 4 values using the %s kernel:\n", squareKernelName);
+    fflush(stdout);
+    facade->squareAndDisplayBatch(facade, batch, 4, STDOUT_FILENO);
+
+    printf("Batch formatting check: %s\n\n",
+           checkBatchFormatting() ? "FAILED" : "ok");
+    fflush(stdout);
+
+    int32_t *values = (int32_t *) malloc(BENCH_VALUES * sizeof(int32_t));
+    unsigned seed = 17;
+
+    for (size_t k = 0; k < BENCH_VALUES; k++) {
+        seed = seed * 1103515245u + 12345u;
+        /* the per-call path squares in int, keep it clear of overflow */
+        values[k] = (int32_t) ((seed >> 4) % 92681) - 46340;
+    }
+
+    int devNull = open("/dev/null", O_WRONLY);
+    int savedStdout = dup(STDOUT_FILENO);
+
+    /* per-call facade, printf output discarded */
+    dup2(devNull, STDOUT_FILENO);
+    uint64_t start = nowNs();
+    for (size_t k = 0; k < BENCH_VALUES; k++) {
+        facade->squareAndDisplay(facade, values[k]);
+    }
+    fflush(stdout);
+    uint64_t perCallNs = nowNs() - start;
+    dup2(savedStdout, STDOUT_FILENO);
+
+    start = nowNs();
+    facade->squareAndDisplayBatch(facade, values, BENCH_VALUES, devNull);
+    uint64_t batchNs = nowNs() - start;
+
+    printf("per-call facade %12.0f values/s\n", BENCH_VALUES / (perCallNs / 1e9));
+    printf("batch facade    %12.0f values/s  (%.1fx)\n",
+           BENCH_VALUES / (batchNs / 1e9), (double) perCallNs / batchNs);
+
+    close(devNull);
+    free(values);
+
+    return 0;
+}
@@ -0,0 +1,366 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Pipelined facade
+ * - The facade still offers a single squareAndDisplay operation, but behind it
+ *   every subsystem runs as a stage on its own thread. The squarer works on
+ *   the next value while the displayer is still busy with the previous one, so
+ *   computation and I/O overlap.
+ */
+
+/**
+ * Stages are connected by single-producer/single-consumer ring buffers, which
+ * need no locks: only the producer moves the head and only the consumer moves
+ * the tail. A full ring makes the upstream stage wait (backpressure). An empty
+ * ring makes the downstream stage back off, and it sleeps if it stays empty.
+ *
+ * squareAndDisplay returns as soon as the value is queued. flush waits until
+ * everything queued so far has been displayed.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Facade_s Facade_t;
+typedef struct Subsystem_s Subsystem_t;
+
+struct Subsystem_s {
+    long (*subsystemFn)(long arg);
+};
+
+Subsystem_t * newSubsystem(long (*subsystemFn)(long))
+{
+    Subsystem_t *subsystem = (Subsystem_t *) malloc(sizeof(Subsystem_t));
+
+    subsystem->subsystemFn = subsystemFn;
+
+    return subsystem;
+}
+
+/*
+ * Single-producer/single-consumer ring
+ */
+typedef struct Item_s {
+    long value;
+    uint64_t submittedNs;
+} Item_t;
+
+#define RING_SIZE 1024  /* power of two */
+
+typedef struct Ring_s {
+    Item_t items[RING_SIZE];
+
+    _Alignas(64) atomic_size_t head;  /* written by the producer only */
+    _Alignas(64) atomic_size_t tail;  /* written by the consumer only */
+} Ring_t;
+
+static void backoff(unsigned *spins)
+{
+    if (++*spins < 100) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, 20000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+void ringPush(Ring_t *ring, const Item_t *item)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned spins = 0;
+
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire)
+           == RING_SIZE) {
+        backoff(&spins);
+    }
+
+    ring->items[head & (RING_SIZE - 1)] = *item;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/* Returns 0 if the ring is empty */
+int ringPop(Ring_t *ring, Item_t *item)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+        return 0;
+    }
+
+    *item = ring->items[tail & (RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return 1;
+}
+
+/*
+ * Facade
+ */
+#define MAX_LATENCIES 1000000
+
+struct Facade_s {
+    Subsystem_t *squarer;
+    Subsystem_t *displayer;
+
+    /* pipelined mode only */
+    int pipelined;
+    Ring_t toSquarer;
+    Ring_t toDisplayer;
+    pthread_t squarerThread;
+    pthread_t displayerThread;
+    atomic_int stopping;
+    atomic_ulong submitted;
+    atomic_ulong displayed;
+
+    /* end-to-end latency of every value, from submission to display */
+    uint64_t *latencies;
+    size_t numLatencies;
+
+    void (*squareAndDisplay)(Facade_t *, long);
+    void (*flush)(Facade_t *);
+};
+
+static void recordLatency(Facade_t *facade, uint64_t submittedNs)
+{
+    if (facade->numLatencies < MAX_LATENCIES) {
+        facade->latencies[facade->numLatencies++] = nowNs() - submittedNs;
+    }
+}
+
+void facadeSquareAndDisplay(Facade_t *facade, long num)
+{
+    uint64_t start = nowNs();
+    long result;
+
+    result = facade->squarer->subsystemFn(num);
+
+    facade->displayer->subsystemFn(result);
+
+    recordLatency(facade, start);
+}
+
+void facadeFlush(Facade_t *facade)
+{
+    (void) facade; /* nothing is ever pending */
+}
+
+void pipelinedSquareAndDisplay(Facade_t *facade, long num)
+{
+    Item_t item = { num, nowNs() };
+
+    ringPush(&facade->toSquarer, &item);
+    atomic_fetch_add(&facade->submitted, 1);
+}
+
+void pipelinedFlush(Facade_t *facade)
+{
+    unsigned spins = 0;
+
+    while (atomic_load(&facade->displayed) != atomic_load(&facade->submitted)) {
+        backoff(&spins);
+    }
+}
+
+static void * squarerStage(void *arg)
+{
+    Facade_t *facade = (Facade_t *) arg;
+    unsigned spins = 0;
+    Item_t item;
+
+    for (;;) {
+        int stopping = atomic_load(&facade->stopping);
+
+        if (ringPop(&facade->toSquarer, &item)) {
+            item.value = facade->squarer->subsystemFn(item.value);
+            ringPush(&facade->toDisplayer, &item);
+            spins = 0;
+        } else if (stopping) {
+            break;
+        } else {
+            backoff(&spins);
+        }
+    }
+
+    return NULL;
+}
+
+static void * displayerStage(void *arg)
+{
+    Facade_t *facade = (Facade_t *) arg;
+    unsigned spins = 0;
+    Item_t item;
+
+    for (;;) {
+        int stopping = atomic_load(&facade->stopping);
+
+        if (ringPop(&facade->toDisplayer, &item)) {
+            facade->displayer->subsystemFn(item.value);
+            recordLatency(facade, item.submittedNs);
+            atomic_fetch_add(&facade->displayed, 1);
+            spins = 0;
+        } else if (stopping && atomic_load(&facade->displayed)
+                               == atomic_load(&facade->submitted)) {
+            break;
+        } else {
+            backoff(&spins);
+        }
+    }
+
+    return NULL;
+}
+
+Facade_t * newFacade(Subsystem_t *squarer, Subsystem_t *displayer,
+                     int pipelined)
+{
+    Facade_t *facade = (Facade_t *) calloc(1, sizeof(Facade_t));
+
+    facade->squarer = squarer;
+    facade->displayer = displayer;
+    facade->latencies = (uint64_t *) malloc(MAX_LATENCIES * sizeof(uint64_t));
+    facade->pipelined = pipelined;
+
+    if (pipelined) {
+        facade->squareAndDisplay = pipelinedSquareAndDisplay;
+        facade->flush = pipelinedFlush;
+
+        pthread_create(&facade->squarerThread, NULL, squarerStage, facade);
+        pthread_create(&facade->displayerThread, NULL, displayerStage, facade);
+    } else {
+        facade->squareAndDisplay = facadeSquareAndDisplay;
+        facade->flush = facadeFlush;
+    }
+
+    return facade;
+}
+
+void deleteFacade(Facade_t *facade)
+{
+    if (facade->pipelined) {
+        atomic_store(&facade->stopping, 1);
+        pthread_join(facade->squarerThread, NULL);
+        pthread_join(facade->displayerThread, NULL);
+    }
+
+    free(facade->latencies);
+    free(facade);
+}
+
+/*
+ * Subsystems. Squaring burns some CPU, displaying waits on a slow device.
+ */
+#define SQUARE_WORK 20000
+#define DISPLAY_WAIT_NS 20000
+
+static volatile long displaySink;
+
+long computeOperation(long arg)
+{
+    volatile long spin = 0;
+
+    for (int k = 0; k < SQUARE_WORK; k++) {
+        spin += k;
+    }
+
+    return arg * arg;
+}
+
+long slowDisplayOperation(long arg)
+{
+    struct timespec ts = { 0, DISPLAY_WAIT_NS };
+
+    nanosleep(&ts, NULL);
+    displaySink = arg;
+
+    return arg;
+}
+
+long printDisplayOperation(long arg)
+{
+    printf("%ld\n", arg);
+
+    return arg;
+}
+
+/*
+ * Benchmark
+ *
+ * Unpaced, the client submits as fast as it can, so pipelined latency is
+ * mostly time spent queued behind the slow displayer.
+ */
+#define BENCH_VALUES 5000
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * With pacing, the client waits between values as a request stream would, so
+ * latency shows the cost of the stages rather than of a backlog.
+ */
+static void runBenchmark(int pipelined, long paceNs)
+{
+    Facade_t *facade = newFacade(newSubsystem(computeOperation),
+                                 newSubsystem(slowDisplayOperation), pipelined);
+    uint64_t start = nowNs();
+
+    for (long k = 0; k < BENCH_VALUES; k++) {
+        facade->squareAndDisplay(facade, k);
+
+        if (paceNs) {
+            struct timespec ts = { 0, paceNs };
+            nanosleep(&ts, NULL);
+        }
+    }
+    facade->flush(facade);
+
+    uint64_t elapsed = nowNs() - start;
+    size_t n = facade->numLatencies;
+
+    qsort(facade->latencies, n, sizeof(uint64_t), compareU64);
+
+    printf("%-11s %-6s %8.0f values/s  latency p50 %8.1f us  p99 %8.1f us\n",
+           pipelined ? "pipelined" : "synchronous", paceNs ? "paced" : "",
+           BENCH_VALUES / (elapsed / 1e9), facade->latencies[n / 2] / 1e3,
+           facade->latencies[n * 99 / 100] / 1e3);
+
+    deleteFacade(facade);
+}
+
+int main(void)
+{
+    Facade_t *facade = newFacade(newSubsystem(computeOperation),
+                                 newSubsystem(printDisplayOperation), 1);
+
+    printf("Squares of 1..5, computed and displayed on two stage threads:\n");
+    for (long k = 1; k <= 5; k++) {
+        facade->squareAndDisplay(facade, k);
+    }
+    facade->flush(facade);
+    deleteFacade(facade);
+
+    printf("\n");
+    runBenchmark(0, 0);
+    runBenchmark(1, 0);
+    runBenchmark(0, 100000);
+    runBenchmark(1, 100000);
+
+    return 0;
+}
@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Memory-budgeted flyweight factory
+ * - Flyweights are reference counted. A client that gets a flyweight holds a
+ *   reference until it releases it.
+ * - The factory keeps flyweights that nobody references as a cache. When the
+ *   bytes held by all flyweights exceed the configured budget, unreferenced
+ *   flyweights are evicted using the CLOCK policy. A flyweight that is asked
+ *   for again after eviction is simply recreated.
+ */
+
+/**
+ * CLOCK approximates LRU with one bit per flyweight instead of a list update on
+ * every hit. All resident flyweights sit on a circular list. A hit only sets
+ * the flyweight's referenced bit. To evict, the clock hand sweeps the circle.
+ * It skips flyweights that are referenced by a client, clears the bit of
+ * those that were used recently, and evicts the first flyweight whose bit is
+ * already clear.
+ *
+ * If every resident flyweight is in use, nothing can be evicted. The factory
+ * then goes over budget rather than fail, and counts how often that happens.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Flyweight_s Flyweight_t;
+typedef struct FlyweightFactory_s FlyweightFactory_t;
+
+struct Flyweight_s {
+    int key;
+    int refs;
+    int referenced;     /* CLOCK bit */
+    size_t bytes;       /* everything this flyweight holds on to */
+
+    /* intrinsic state, of a size that depends on the key */
+    size_t stateLen;
+    unsigned char *intState;
+
+    Flyweight_t *hashNext;
+    Flyweight_t *clockPrev;
+    Flyweight_t *clockNext;
+
+    unsigned long (*operation)(Flyweight_t *, unsigned long extState);
+};
+
+unsigned long flyweightOperation(Flyweight_t *fw, unsigned long extState)
+{
+    return extState * 31 + fw->intState[extState % fw->stateLen];
+}
+
+Flyweight_t * newFlyweight(int key)
+{
+    Flyweight_t *fw = (Flyweight_t *) calloc(1, sizeof(Flyweight_t));
+
+    fw->key = key;
+    fw->stateLen = 64 + (size_t) (key * 37) % 960;
+    fw->intState = (unsigned char *) malloc(fw->stateLen);
+    memset(fw->intState, key & 0xFF, fw->stateLen);
+    fw->bytes = sizeof(Flyweight_t) + fw->stateLen;
+
+    fw->operation = flyweightOperation;
+
+    return fw;
+}
+
+void deleteFlyweight(Flyweight_t *fw)
+{
+    free(fw->intState);
+    free(fw);
+}
+
+typedef struct Counters_s {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long overBudget;   /* inserts that could not make enough room */
+    size_t residentBytes;
+    size_t peakBytes;
+    size_t resident;
+} Counters_t;
+
+struct FlyweightFactory_s {
+    size_t budgetBytes;
+
+    Flyweight_t **buckets;
+    size_t numBuckets;          /* power of two */
+
+    Flyweight_t *hand;          /* NULL when nothing is resident */
+
+    Counters_t counters;
+
+    Flyweight_t *(*getFlyweight)(FlyweightFactory_t *, int);
+    void (*releaseFlyweight)(FlyweightFactory_t *, Flyweight_t *);
+};
+
+static size_t bucketOf(const FlyweightFactory_t *f, int key)
+{
+    return ((uint32_t) key * 2654435761u) & (f->numBuckets - 1);
+}
+
+static void hashInsert(FlyweightFactory_t *f, Flyweight_t *fw)
+{
+    size_t b = bucketOf(f, fw->key);
+
+    fw->hashNext = f->buckets[b];
+    f->buckets[b] = fw;
+}
+
+static void hashRemove(FlyweightFactory_t *f, Flyweight_t *fw)
+{
+    Flyweight_t **p = &f->buckets[bucketOf(f, fw->key)];
+
+    while (*p != fw) {
+        p = &(*p)->hashNext;
+    }
+    *p = fw->hashNext;
+}
+
+static void growBuckets(FlyweightFactory_t *f)
+{
+    Flyweight_t **old = f->buckets;
+    size_t oldCount = f->numBuckets;
+
+    f->numBuckets *= 2;
+    f->buckets = (Flyweight_t **) calloc(f->numBuckets, sizeof(Flyweight_t *));
+
+    for (size_t b = 0; b < oldCount; b++) {
+        Flyweight_t *fw = old[b];
+
+        while (fw) {
+            Flyweight_t *next = fw->hashNext;
+
+            hashInsert(f, fw);
+            fw = next;
+        }
+    }
+
+    free(old);
+}
+
+/* New flyweights join the circle just behind the hand, as the last to be seen */
+static void clockInsert(FlyweightFactory_t *f, Flyweight_t *fw)
+{
+    if (!f->hand) {
+        fw->clockPrev = fw->clockNext = fw;
+        f->hand = fw;
+        return;
+    }
+
+    fw->clockNext = f->hand;
+    fw->clockPrev = f->hand->clockPrev;
+    fw->clockPrev->clockNext = fw;
+    f->hand->clockPrev = fw;
+}
+
+static void clockRemove(FlyweightFactory_t *f, Flyweight_t *fw)
+{
+    if (fw->clockNext == fw) {
+        f->hand = NULL;
+        return;
+    }
+
+    if (f->hand == fw) {
+        f->hand = fw->clockNext;
+    }
+    fw->clockPrev->clockNext = fw->clockNext;
+    fw->clockNext->clockPrev = fw->clockPrev;
+}
+
+static void evictOne(FlyweightFactory_t *f, Flyweight_t *fw)
+{
+    clockRemove(f, fw);
+    hashRemove(f, fw);
+
+    f->counters.residentBytes -= fw->bytes;
+    f->counters.resident--;
+    f->counters.evictions++;
+
+    deleteFlyweight(fw);
+}
+
+/*
+ * Sweep until the budget is met. Two full turns without finding a victim
+ * means every resident flyweight is in use.
+ */
+static void enforceBudget(FlyweightFactory_t *f, const Flyweight_t *keep)
+{
+    size_t sinceEviction = 0;
+
+    while (f->counters.residentBytes > f->budgetBytes && f->hand) {
+        Flyweight_t *fw = f->hand;
+
+        if (sinceEviction > 2 * f->counters.resident) {
+            f->counters.overBudget++;
+            return;
+        }
+
+        f->hand = fw->clockNext;
+        sinceEviction++;
+
+        if (fw->refs > 0 || fw == keep) {
+            continue;
+        }
+
+        if (fw->referenced) {
+            fw->referenced = 0;
+            continue;
+        }
+
+        evictOne(f, fw);
+        sinceEviction = 0;
+    }
+}
+
+Flyweight_t * getFlyweight(FlyweightFactory_t *f, int key)
+{
+    Flyweight_t *fw = f->buckets[bucketOf(f, key)];
+
+    while (fw && fw->key != key) {
+        fw = fw->hashNext;
+    }
+
+    if (fw) {
+        f->counters.hits++;
+    } else {
+        f->counters.misses++;
+
+        fw = newFlyweight(key);
+        hashInsert(f, fw);
+        clockInsert(f, fw);
+
+        f->counters.resident++;
+        f->counters.residentBytes += fw->bytes;
+
+        enforceBudget(f, fw);
+
+        if (f->counters.residentBytes > f->counters.peakBytes) {
+            f->counters.peakBytes = f->counters.residentBytes;
+        }
+
+        if (f->counters.resident > f->numBuckets) {
+            growBuckets(f);
+        }
+    }
+
+    fw->refs++;
+    fw->referenced = 1;
+
+    return fw;
+}
+
+void releaseFlyweight(FlyweightFactory_t *f, Flyweight_t *fw)
+{
+    (void) f;
+
+    fw->refs--;
+}
+
+FlyweightFactory_t * newFlyweightFactory(size_t budgetBytes)
+{
+    FlyweightFactory_t *f = (FlyweightFactory_t *) calloc(1, sizeof(FlyweightFactory_t));
+
+    f->budgetBytes = budgetBytes;
+    f->numBuckets = 1024;
+    f->buckets = (Flyweight_t **) calloc(f->numBuckets, sizeof(Flyweight_t *));
+
+    f->getFlyweight = getFlyweight;
+    f->releaseFlyweight = releaseFlyweight;
+
+    return f;
+}
+
+static void printCounters(const char *label, const Counters_t *c)
+{
+    unsigned long lookups = c->hits + c->misses;
+
+    printf("%-10s hit rate %5.1f%%  evictions %8lu  resident %6zu flyweights"
+           " %7.2f MB  peak %7.2f MB%s\n",
+           label, lookups ? 100.0 * c->hits / lookups : 0.0, c->evictions,
+           c->resident, c->residentBytes / 1e6, c->peakBytes / 1e6,
+           c->overBudget ? "  (went over budget)" : "");
+}
+
+/*
+ * Benchmark: a working set of WORKING_SET keys that slides through the key
+ * space, so yesterday's hot keys go cold and never come back. Each phase makes
+ * ACCESSES_PER_PHASE accesses, every one a get, an operation and a release.
+ * The budgeted factory has room for a bit more than one working set, while
+ * the unbounded one keeps everything it ever created.
+ */
+#define PHASES 10
+#define WORKING_SET 20000
+#define SHIFT_PER_PHASE 10000
+#define ACCESSES_PER_PHASE 2000000
+#define BUDGET_BYTES (16u << 20)
+
+static void runBenchmark(FlyweightFactory_t *f, const char *label)
+{
+    unsigned seed = 19;
+    unsigned long sink = 0;
+
+    printf("%s factory, budget %s\n", label,
+           f->budgetBytes == SIZE_MAX ? "none" : "16 MB");
+
+    uint64_t start = nowNs();
+
+    for (int phase = 0; phase < PHASES; phase++) {
+        Counters_t before = f->counters;
+
+        for (int k = 0; k < ACCESSES_PER_PHASE; k++) {
+            seed = seed * 1103515245u + 12345u;
+
+            int key = phase * SHIFT_PER_PHASE + (int) ((seed >> 8) % WORKING_SET);
+            Flyweight_t *fw = f->getFlyweight(f, key);
+
+            sink += fw->operation(fw, (unsigned long) k);
+            f->releaseFlyweight(f, fw);
+        }
+
+        Counters_t phaseCounters = f->counters;
+        char name[16];
+
+        phaseCounters.hits -= before.hits;
+        phaseCounters.misses -= before.misses;
+        phaseCounters.evictions -= before.evictions;
+        snprintf(name, sizeof(name), "phase %d", phase);
+        printCounters(name, &phaseCounters);
+    }
+
+    printCounters("total", &f->counters);
+    printf("%.1f M accesses/s (checksum %lu)\n\n",
+           PHASES * (double) ACCESSES_PER_PHASE / ((nowNs() - start) / 1e3),
+           sink);
+}
+
+int main(void)
+{
+    FlyweightFactory_t *f = newFlyweightFactory(2048);
+    Flyweight_t *pinned = f->getFlyweight(f, 1);
+
+    /* flyweight 1 stays referenced, the others come and go under a 2 KB budget */
+    for (int k = 0; k < 40; k++) {
+        Flyweight_t *fw = f->getFlyweight(f, 2 + k % 20);
+
+        f->releaseFlyweight(f, fw);
+    }
+
+    printf("pinned flyweight %d still resident: %s\n", pinned->key,
+           f->getFlyweight(f, 1) == pinned ? "yes" : "NO");
+    f->releaseFlyweight(f, pinned);
+    f->releaseFlyweight(f, pinned);
+    printf("%zu bytes resident with a budget of %zu\n",
+           f->counters.residentBytes, f->budgetBytes);
+    printCounters("small", &f->counters);
+    printf("\n");
+
+    runBenchmark(newFlyweightFactory(BUDGET_BYTES), "Budgeted");
+    runBenchmark(newFlyweightFactory(SIZE_MAX), "Unbounded");
+
+    return 0;
+}
@@ -0,0 +1,522 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Concurrent flyweight factory
+ * - The factory interns any number of keys, shared by any number of threads.
+ *   Flyweights live in an open-addressing hash table. Lookups never take a
+ *   lock, and two threads that ask for the same new key at the same time still
+ *   end up with one and the same flyweight.
+ */
+
+/**
+ * Every slot holds a key and a flyweight pointer, both atomic. The table uses
+ * linear probing.
+ *
+ * - A lookup probes until it finds the key or an empty slot.
+ * - get-or-create probes the same way. When it reaches an empty slot, it claims
+ *   the slot by CAS on the key. The thread that wins the CAS creates the
+ *   flyweight and publishes the pointer. A thread that loses, or that finds
+ *   the key already claimed, waits for the pointer to appear. A thread that
+ *   loses to a different key keeps probing.
+ * - When the table is half full, it doubles. Inserting threads register
+ *   themselves for the duration of an insert. The thread that resizes turns
+ *   new inserters away and waits for the registered ones to leave. It then
+ *   rehashes into the new table and publishes it. Lookups are not held up:
+ *   the old table stays valid and complete, because nothing was inserted while
+ *   it was being copied. Retired tables are freed with the factory.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Flyweight_s Flyweight_t;
+typedef struct FlyweightFactory_s FlyweightFactory_t;
+
+struct Flyweight_s {
+    int64_t key;
+    int64_t intState;
+    int64_t extState;
+
+    void (*operation)(Flyweight_t *, int64_t extState);
+};
+
+void flyweightOperation(Flyweight_t *fw, int64_t extState)
+{
+    fw->extState = extState;
+
+    /* The intrinsic state differs from the extrinsic state */
+    fw->intState = 2*fw->extState;
+}
+
+Flyweight_t * newFlyweight(int64_t key)
+{
+    Flyweight_t *fw = (Flyweight_t *) malloc(sizeof(Flyweight_t));
+
+    fw->key = key;
+    fw->intState = 0;
+    fw->extState = 0;
+
+    fw->operation = flyweightOperation;
+
+    return fw;
+}
+
+/*
+ * Hash table. Keys are stored with the sign bit flipped, so that 0 marks an
+ * empty slot and every int64_t key other than INT64_MIN can be interned.
+ */
+typedef struct Slot_s {
+    _Atomic uint64_t key;
+    _Atomic(Flyweight_t *) fw;
+} Slot_t;
+
+typedef struct Table_s {
+    size_t mask;                /* capacity - 1, capacity a power of two */
+    atomic_size_t count;
+    struct Table_s *retired;    /* the table this one replaced */
+    Slot_t slots[];
+} Table_t;
+
+#define INITIAL_CAPACITY 1024
+
+static Table_t * newTable(size_t capacity, Table_t *retired)
+{
+    Table_t *t = (Table_t *) calloc(1, sizeof(Table_t)
+                                       + capacity * sizeof(Slot_t));
+
+    t->mask = capacity - 1;
+    t->retired = retired;
+
+    return t;
+}
+
+static inline uint64_t storedKey(int64_t key)
+{
+    return (uint64_t) key ^ 0x8000000000000000ull;
+}
+
+static inline uint64_t hashKey(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+static void spinPause(unsigned *spins)
+{
+    if (++*spins > 64) {
+        sched_yield();
+    }
+}
+
+/* Wait for the thread that claimed the slot to publish its flyweight */
+static Flyweight_t * awaitFlyweight(Slot_t *slot)
+{
+    Flyweight_t *fw;
+    unsigned spins = 0;
+
+    while (!(fw = atomic_load_explicit(&slot->fw, memory_order_acquire))) {
+        spinPause(&spins);
+    }
+
+    return fw;
+}
+
+struct FlyweightFactory_s {
+    _Atomic(Table_t *) table;
+
+    atomic_int resizing;
+    atomic_int inserters;
+    pthread_mutex_t resizeLock;
+
+    atomic_long numFlyweights;
+
+    Flyweight_t *(*getFlyweight)(FlyweightFactory_t *, int64_t);
+    Flyweight_t *(*lookupFlyweight)(FlyweightFactory_t *, int64_t);
+};
+
+Flyweight_t * lookupFlyweight(FlyweightFactory_t *f, int64_t key)
+{
+    Table_t *t = atomic_load_explicit(&f->table, memory_order_acquire);
+    uint64_t stored = storedKey(key);
+
+    for (size_t k = hashKey(stored) & t->mask; ; k = (k + 1) & t->mask) {
+        uint64_t found = atomic_load_explicit(&t->slots[k].key,
+                                              memory_order_acquire);
+
+        if (found == stored) {
+            return awaitFlyweight(&t->slots[k]);
+        }
+        if (found == 0) {
+            return NULL;
+        }
+    }
+}
+
+/* Only called while no insert is in progress, so plain probing is enough */
+static void rehashInto(Table_t *to, const Table_t *from)
+{
+    for (size_t j = 0; j <= from->mask; j++) {
+        uint64_t key = atomic_load_explicit(&from->slots[j].key,
+                                            memory_order_relaxed);
+
+        if (key == 0) {
+            continue;
+        }
+
+        size_t k = hashKey(key) & to->mask;
+
+        while (atomic_load_explicit(&to->slots[k].key, memory_order_relaxed)) {
+            k = (k + 1) & to->mask;
+        }
+
+        atomic_store_explicit(&to->slots[k].key, key, memory_order_relaxed);
+        atomic_store_explicit(&to->slots[k].fw,
+                              atomic_load_explicit(&from->slots[j].fw,
+                                                   memory_order_relaxed),
+                              memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&to->count,
+                          atomic_load_explicit(&from->count,
+                                               memory_order_relaxed),
+                          memory_order_relaxed);
+}
+
+static void growTable(FlyweightFactory_t *f, Table_t *seen)
+{
+    pthread_mutex_lock(&f->resizeLock);
+
+    Table_t *t = atomic_load(&f->table);
+
+    if (t == seen) {
+        unsigned spins = 0;
+
+        atomic_store(&f->resizing, 1);
+        while (atomic_load(&f->inserters) > 0) {
+            spinPause(&spins);
+        }
+
+        Table_t *bigger = newTable(2 * (t->mask + 1), t);
+
+        rehashInto(bigger, t);
+        atomic_store_explicit(&f->table, bigger, memory_order_release);
+        atomic_store(&f->resizing, 0);
+    }
+
+    pthread_mutex_unlock(&f->resizeLock);
+}
+
+static void enterInsert(FlyweightFactory_t *f)
+{
+    unsigned spins = 0;
+
+    for (;;) {
+        while (atomic_load(&f->resizing)) {
+            spinPause(&spins);
+        }
+
+        atomic_fetch_add(&f->inserters, 1);
+        if (!atomic_load(&f->resizing)) {
+            return;
+        }
+        atomic_fetch_sub(&f->inserters, 1);
+    }
+}
+
+Flyweight_t * getFlyweight(FlyweightFactory_t *f, int64_t key)
+{
+    Flyweight_t *fw = lookupFlyweight(f, key);
+
+    if (fw || key == INT64_MIN) {
+        return fw;
+    }
+
+    uint64_t stored = storedKey(key);
+    Table_t *t;
+    int full = 0;
+
+    enterInsert(f);
+    t = atomic_load_explicit(&f->table, memory_order_acquire);
+
+    for (size_t k = hashKey(stored) & t->mask; ; k = (k + 1) & t->mask) {
+        Slot_t *slot = &t->slots[k];
+        uint64_t found = atomic_load_explicit(&slot->key, memory_order_acquire);
+
+        if (found == 0 &&
+            atomic_compare_exchange_strong(&slot->key, &found, stored)) {
+            /* this thread claimed the slot, create the flyweight */
+            fw = newFlyweight(key);
+            atomic_store_explicit(&slot->fw, fw, memory_order_release);
+            atomic_fetch_add(&f->numFlyweights, 1);
+            full = atomic_fetch_add(&t->count, 1) + 1 > (t->mask + 1) / 2;
+            break;
+        }
+
+        if (found == stored) {
+            fw = awaitFlyweight(slot);
+            break;
+        }
+    }
+
+    atomic_fetch_sub(&f->inserters, 1);
+
+    if (full) {
+        growTable(f, t);
+    }
+
+    return fw;
+}
+
+FlyweightFactory_t * newFlyweightFactory(void)
+{
+    FlyweightFactory_t *f = (FlyweightFactory_t *) calloc(1, sizeof(FlyweightFactory_t));
+
+    atomic_init(&f->table, newTable(INITIAL_CAPACITY, NULL));
+    pthread_mutex_init(&f->resizeLock, NULL);
+
+    f->getFlyweight = getFlyweight;
+    f->lookupFlyweight = lookupFlyweight;
+
+    return f;
+}
+
+void deleteFlyweightFactory(FlyweightFactory_t *f)
+{
+    Table_t *t = atomic_load(&f->table);
+
+    for (size_t k = 0; k <= t->mask; k++) {
+        free(atomic_load(&t->slots[k].fw));
+    }
+
+    while (t) {
+        Table_t *retired = t->retired;
+
+        free(t);
+        t = retired;
+    }
+
+    pthread_mutex_destroy(&f->resizeLock);
+    free(f);
+}
+
+/*
+ * Race check: every thread gets-or-creates the same keys in a different order.
+ * All of them must see the same flyweight for a key, and each key must be
+ * created exactly once.
+ */
+#define RACE_THREADS 4
+#define RACE_KEYS 20000
+
+typedef struct Worker_s {
+    FlyweightFactory_t *factory;
+    const int64_t *keys;
+    size_t begin;
+    size_t end;
+    int id;
+    Flyweight_t **seen;
+    unsigned long found;
+} Worker_t;
+
+static void * raceWorker(void *arg)
+{
+    Worker_t *w = (Worker_t *) arg;
+
+    for (size_t j = 0; j < RACE_KEYS; j++) {
+        size_t k = (j * 7919 + (size_t) w->id * 5003) % RACE_KEYS;
+
+        w->seen[k] = w->factory->getFlyweight(w->factory, (int64_t) k * 3 - 100);
+    }
+
+    return NULL;
+}
+
+static int checkRaces(void)
+{
+    FlyweightFactory_t *f = newFlyweightFactory();
+    pthread_t threads[RACE_THREADS];
+    Worker_t workers[RACE_THREADS];
+    int bad = 0;
+
+    for (int t = 0; t < RACE_THREADS; t++) {
+        workers[t].factory = f;
+        workers[t].id = t;
+        workers[t].seen = (Flyweight_t **) malloc(RACE_KEYS * sizeof(Flyweight_t *));
+        pthread_create(&threads[t], NULL, raceWorker, &workers[t]);
+    }
+
+    for (int t = 0; t < RACE_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (size_t k = 0; k < RACE_KEYS; k++) {
+        Flyweight_t *fw = workers[0].seen[k];
+
+        bad += fw->key != (int64_t) k * 3 - 100;
+        bad += f->lookupFlyweight(f, fw->key) != fw;
+
+        for (int t = 1; t < RACE_THREADS; t++) {
+            bad += workers[t].seen[k] != fw;
+        }
+    }
+
+    bad += atomic_load(&f->numFlyweights) != RACE_KEYS;
+
+    for (int t = 0; t < RACE_THREADS; t++) {
+        free(workers[t].seen);
+    }
+    deleteFlyweightFactory(f);
+
+    return bad;
+}
+
+/*
+ * Benchmark: every thread interns its share of the keys, then every thread
+ * looks up as many keys as it inserted, chosen at random from all of them.
+ *
+ * 100M keys need several GB, so the larger key count defaults to 10M. Set
+ * FLYWEIGHT_LARGE_KEYS to run it with another count, e.g. 100000000. Under
+ * ThreadSanitizer, whose shadow memory would not fit 10M keys, it defaults to
+ * 200K.
+ */
+#define SMALL_KEYS 1000000
+#ifdef __SANITIZE_THREAD__
+#define LARGE_KEYS 200000
+#else
+#define LARGE_KEYS 10000000
+#endif
+
+static const int64_t *benchKeys;
+
+static void * insertWorker(void *arg)
+{
+    Worker_t *w = (Worker_t *) arg;
+
+    for (size_t k = w->begin; k < w->end; k++) {
+        w->factory->getFlyweight(w->factory, benchKeys[k]);
+    }
+
+    return NULL;
+}
+
+static void * lookupWorker(void *arg)
+{
+    Worker_t *w = (Worker_t *) arg;
+    uint64_t x = (uint64_t) w->id * 0x9e3779b97f4a7c15ull + 1;
+    size_t numKeys = atomic_load(&w->factory->numFlyweights);
+
+    for (size_t k = w->begin; k < w->end; k++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        w->found += w->factory->lookupFlyweight(w->factory,
+                                                benchKeys[x % numKeys]) != NULL;
+    }
+
+    return NULL;
+}
+
+static double runPhase(FlyweightFactory_t *f, size_t numKeys, int numThreads,
+                       void *(*fn)(void *), unsigned long *found)
+{
+    pthread_t threads[64];
+    Worker_t workers[64];
+    uint64_t start = nowNs();
+
+    for (int t = 0; t < numThreads; t++) {
+        workers[t].factory = f;
+        workers[t].id = t;
+        workers[t].begin = numKeys * (size_t) t / (size_t) numThreads;
+        workers[t].end = numKeys * (size_t) (t + 1) / (size_t) numThreads;
+        workers[t].found = 0;
+        pthread_create(&threads[t], NULL, fn, &workers[t]);
+    }
+
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(threads[t], NULL);
+        if (found) {
+            *found += workers[t].found;
+        }
+    }
+
+    return numKeys / ((nowNs() - start) / 1e9);
+}
+
+static void runBenchmark(size_t numKeys, int maxThreads)
+{
+    int64_t *keys = (int64_t *) malloc(numKeys * sizeof(int64_t));
+
+    /* distinct keys in a scattered order */
+    for (size_t k = 0; k < numKeys; k++) {
+        keys[k] = (int64_t) (hashKey(k) >> 1);
+    }
+    benchKeys = keys;
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        FlyweightFactory_t *f = newFlyweightFactory();
+        unsigned long found = 0;
+        double inserts = runPhase(f, numKeys, threads, insertWorker, NULL);
+        double lookups = runPhase(f, numKeys, threads, lookupWorker, &found);
+
+        printf("%9zu keys %2d threads  insert %6.2f M/s  lookup %6.2f M/s%s\n",
+               numKeys, threads, inserts / 1e6, lookups / 1e6,
+               found == numKeys && (size_t) atomic_load(&f->numFlyweights)
+                                   == numKeys ? "" : "  MISMATCH");
+
+        deleteFlyweightFactory(f);
+    }
+
+    free(keys);
+}
+
+int main(void)
+{
+    FlyweightFactory_t *f = newFlyweightFactory();
+    Flyweight_t *fw[10];
+
+    for (int k = 0; k < 10; k++) {
+        fw[k] = f->getFlyweight(f, k % 5);
+        fw[k]->operation(fw[k], k);
+    }
+
+    printf("Flyweights created: %ld\n", atomic_load(&f->numFlyweights));
+    for (int k = 0; k < 5; k++) {
+        printf("Flyweight[%d]: key=%lld, intrinsic state=%lld, extrinsic state=%lld\n",
+               k, (long long) fw[k]->key, (long long) fw[k]->intState,
+               (long long) fw[k]->extState);
+    }
+    deleteFlyweightFactory(f);
+
+    printf("\nRace check with %d threads: %s\n\n", RACE_THREADS,
+           checkRaces() ? "FAILED" : "ok");
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cores < 2 ? 2 : cores > 64 ? 64 : (int) cores;
+    const char *large = getenv("FLYWEIGHT_LARGE_KEYS");
+
+    printf("%ld online cores\n", cores);
+    runBenchmark(SMALL_KEYS, maxThreads);
+    runBenchmark(large ? (size_t) strtoull(large, NULL, 10) : LARGE_KEYS,
+                 maxThreads);
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * String interning flyweights
+ * - Each distinct string is stored once. Clients get back a handle, a small
+ *   integer, instead of a pointer to their own copy. Two handles from the same
+ *   factory are equal exactly when their strings are, so comparing strings
+ *   becomes one integer compare.
+ */
+
+/**
+ * The strings live in an append-only arena made of large blocks that are never
+ * moved or freed while the factory exists, so the text behind a handle stays
+ * put. Every string is stored with its precomputed hash and its length in
+ * front of it and a NUL after it, so it can be handed to C string functions
+ * as is.
+ *
+ * Lookup goes through an open-addressing table of handles. A probe looks at the
+ * stored hash first, then the length, and compares bytes only when both
+ * match.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef uint32_t Handle_t;     /* 0 is never a valid handle */
+
+typedef struct StringFlyweight_s {
+    uint32_t hash;
+    uint32_t len;
+    char text[];                /* len bytes and a NUL */
+} StringFlyweight_t;
+
+/*
+ * Arena
+ */
+#define ARENA_BLOCK (64 * 1024)
+
+typedef struct ArenaBlock_s {
+    struct ArenaBlock_s *next;
+    size_t used;
+    size_t size;
+    _Alignas(8) char data[];
+} ArenaBlock_t;
+
+typedef struct Arena_s {
+    ArenaBlock_t *blocks;       /* newest first */
+    size_t bytes;               /* allocated, including unused block tails */
+} Arena_t;
+
+static void * arenaAlloc(Arena_t *arena, size_t n)
+{
+    ArenaBlock_t *b = arena->blocks;
+
+    n = (n + 7) & ~(size_t) 7;
+
+    if (!b || b->used + n > b->size) {
+        /* strings too long for a normal block get a block of their own */
+        size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+
+        b = (ArenaBlock_t *) malloc(sizeof(ArenaBlock_t) + size);
+        b->used = 0;
+        b->size = size;
+        b->next = arena->blocks;
+        arena->blocks = b;
+        arena->bytes += sizeof(ArenaBlock_t) + size;
+    }
+
+    void *p = b->data + b->used;
+
+    b->used += n;
+
+    return p;
+}
+
+/*
+ * Factory
+ */
+typedef struct FlyweightFactory_s FlyweightFactory_t;
+
+struct FlyweightFactory_s {
+    Arena_t arena;
+
+    StringFlyweight_t **flyweights;     /* indexed by handle */
+    uint32_t numFlyweights;             /* handles 1..numFlyweights are used */
+    uint32_t capacity;
+
+    Handle_t *table;                    /* 0 marks an empty slot */
+    size_t tableMask;
+
+    Handle_t (*getFlyweight)(FlyweightFactory_t *, const char *, size_t);
+    const char *(*text)(const FlyweightFactory_t *, Handle_t);
+    size_t (*length)(const FlyweightFactory_t *, Handle_t);
+};
+
+/* FNV-1a */
+static uint32_t hashString(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t k = 0; k < len; k++) {
+        h = (h ^ (unsigned char) s[k]) * 16777619u;
+    }
+
+    return h;
+}
+
+static void growTable(FlyweightFactory_t *f)
+{
+    size_t size = 2 * (f->tableMask + 1);
+
+    free(f->table);
+    f->table = (Handle_t *) calloc(size, sizeof(Handle_t));
+    f->tableMask = size - 1;
+
+    /* the hashes are stored, so nothing is rehashed from the text */
+    for (Handle_t h = 1; h <= f->numFlyweights; h++) {
+        size_t k = f->flyweights[h]->hash & f->tableMask;
+
+        while (f->table[k]) {
+            k = (k + 1) & f->tableMask;
+        }
+        f->table[k] = h;
+    }
+}
+
+Handle_t getFlyweight(FlyweightFactory_t *f, const char *s, size_t len)
+{
+    uint32_t hash = hashString(s, len);
+    size_t k = hash & f->tableMask;
+
+    for (; f->table[k]; k = (k + 1) & f->tableMask) {
+        const StringFlyweight_t *fw = f->flyweights[f->table[k]];
+
+        if (fw->hash == hash && fw->len == len && memcmp(fw->text, s, len) == 0) {
+            return f->table[k];
+        }
+    }
+
+    /* not interned yet */
+    StringFlyweight_t *fw = (StringFlyweight_t *)
+                            arenaAlloc(&f->arena, sizeof(StringFlyweight_t) + len + 1);
+
+    fw->hash = hash;
+    fw->len = (uint32_t) len;
+    memcpy(fw->text, s, len);
+    fw->text[len] = '\0';
+
+    if (f->numFlyweights + 1 == f->capacity) {
+        f->capacity *= 2;
+        f->flyweights = (StringFlyweight_t **)
+                        realloc(f->flyweights, f->capacity * sizeof(StringFlyweight_t *));
+    }
+
+    Handle_t h = ++f->numFlyweights;
+
+    f->flyweights[h] = fw;
+    f->table[k] = h;
+
+    /* keep the table at most half full */
+    if (2 * (size_t) f->numFlyweights > f->tableMask + 1) {
+        growTable(f);
+    }
+
+    return h;
+}
+
+const char * flyweightText(const FlyweightFactory_t *f, Handle_t h)
+{
+    return f->flyweights[h]->text;
+}
+
+size_t flyweightLength(const FlyweightFactory_t *f, Handle_t h)
+{
+    return f->flyweights[h]->len;
+}
+
+FlyweightFactory_t * newFlyweightFactory(void)
+{
+    FlyweightFactory_t *f = (FlyweightFactory_t *) calloc(1, sizeof(FlyweightFactory_t));
+
+    f->capacity = 1024;
+    f->flyweights = (StringFlyweight_t **) malloc(f->capacity * sizeof(StringFlyweight_t *));
+    f->tableMask = 2047;
+    f->table = (Handle_t *) calloc(f->tableMask + 1, sizeof(Handle_t));
+
+    f->getFlyweight = getFlyweight;
+    f->text = flyweightText;
+    f->length = flyweightLength;
+
+    return f;
+}
+
+/* Memory held by the factory: arena, handle index and hash table */
+static size_t factoryBytes(const FlyweightFactory_t *f)
+{
+    return f->arena.bytes + f->capacity * sizeof(StringFlyweight_t *)
+           + (f->tableMask + 1) * sizeof(Handle_t);
+}
+
+/*
+ * Benchmark corpus: identifiers of the kind found in source code and protocol
+ * headers, built from common parts. Tokens are drawn with a heavy skew, as in
+ * real code, where a few names account for most occurrences.
+ */
+#define CORPUS_TOKENS 2000000
+
+static const char *verbs[] = {
+    "get", "set", "is", "has", "on", "to", "from", "update", "create",
+    "delete", "find", "parse", "read", "write", "handle", "compute",
+};
+static const char *nouns[] = {
+    "Name", "Value", "Count", "Id", "User", "Buffer", "Request", "Response",
+    "Header", "Length", "Offset", "Index", "Node", "Child", "Parent", "Key",
+    "Session", "Token", "Config", "Path", "File", "Stream", "Event", "Handler",
+    "Content", "Type", "Encoding", "Cache", "Control", "Connection", "Range",
+    "Timeout",
+};
+static const char *suffixes[] = {
+    "", "s", "At", "Map", "List", "Ptr", "Len", "Size", "Hint", "Flag",
+};
+
+static size_t makeIdentifier(char *out, unsigned n)
+{
+    unsigned numVerbs = sizeof(verbs) / sizeof(verbs[0]);
+    unsigned numNouns = sizeof(nouns) / sizeof(nouns[0]);
+    unsigned numSuffixes = sizeof(suffixes) / sizeof(suffixes[0]);
+
+    return (size_t) sprintf(out, "%s%s%s%s", verbs[n % numVerbs],
+                            nouns[n / numVerbs % numNouns],
+                            nouns[n / numVerbs / numNouns % numNouns],
+                            suffixes[n / numVerbs / numNouns / numNouns
+                                     % numSuffixes]);
+}
+
+int main(void)
+{
+    FlyweightFactory_t *f = newFlyweightFactory();
+    const char *words[] = { "Content-Type", "Host", "Content-Type", "Accept",
+                            "Host", "Content-Type" };
+    Handle_t handles[6];
+
+    for (int k = 0; k < 6; k++) {
+        handles[k] = f->getFlyweight(f, words[k], strlen(words[k]));
+        printf("\"%s\" -> handle %u\n", words[k], handles[k]);
+    }
+    printf("handle %u is \"%s\", %zu bytes; %u distinct strings\n\n",
+           handles[0], f->text(f, handles[0]), f->length(f, handles[0]),
+           f->numFlyweights);
+
+    /* the corpus, as the strings a tokenizer would hand us */
+    char **tokens = (char **) malloc(CORPUS_TOKENS * sizeof(char *));
+    size_t *lens = (size_t *) malloc(CORPUS_TOKENS * sizeof(size_t));
+    size_t copyBytes = 0;
+    unsigned seed = 23;
+    char buf[128];
+
+    for (size_t k = 0; k < CORPUS_TOKENS; k++) {
+        seed = seed * 1103515245u + 12345u;
+
+        /* skewed: small ranks are far more likely than large ones */
+        double u = (seed >> 8) / (double) (1u << 24);
+        unsigned rank = (unsigned) (u * u * u * u * 40000);
+
+        lens[k] = makeIdentifier(buf, rank);
+        tokens[k] = (char *) malloc(lens[k] + 1);
+        memcpy(tokens[k], buf, lens[k] + 1);
+        copyBytes += lens[k] + 1;
+    }
+
+    FlyweightFactory_t *corpus = newFlyweightFactory();
+    Handle_t *ids = (Handle_t *) malloc(CORPUS_TOKENS * sizeof(Handle_t));
+
+    uint64_t start = nowNs();
+    for (size_t k = 0; k < CORPUS_TOKENS; k++) {
+        ids[k] = corpus->getFlyweight(corpus, tokens[k], lens[k]);
+    }
+    uint64_t internNs = nowNs() - start;
+
+    /* once everything is interned, every further lookup is a hit */
+    start = nowNs();
+    for (size_t k = 0; k < CORPUS_TOKENS; k++) {
+        ids[k] = corpus->getFlyweight(corpus, tokens[k], lens[k]);
+    }
+    uint64_t lookupNs = nowNs() - start;
+
+    printf("%d tokens, %u distinct identifiers\n", CORPUS_TOKENS,
+           corpus->numFlyweights);
+    printf("one copy per token  %8.2f MB (string bytes only)\n", copyBytes / 1e6);
+    printf("interned            %8.2f MB (arena, index and table)"
+           " + %.2f MB of handles\n", factoryBytes(corpus) / 1e6,
+           CORPUS_TOKENS * sizeof(Handle_t) / 1e6);
+    printf("first pass          %8.1f M tokens/s\n", CORPUS_TOKENS / (internNs / 1e3));
+    printf("lookups             %8.1f M tokens/s\n\n", CORPUS_TOKENS / (lookupNs / 1e3));
+
+    /* count occurrences of one identifier: strcmp against handle compare */
+    makeIdentifier(buf, 1);
+
+    const char *needle = buf;
+    Handle_t needleId = corpus->getFlyweight(corpus, buf, strlen(buf));
+    size_t byText = 0, byHandle = 0;
+
+    start = nowNs();
+    for (size_t k = 0; k < CORPUS_TOKENS; k++) {
+        byText += strcmp(tokens[k], needle) == 0;
+    }
+    uint64_t textNs = nowNs() - start;
+
+    start = nowNs();
+    for (size_t k = 0; k < CORPUS_TOKENS; k++) {
+        byHandle += ids[k] == needleId;
+    }
+    uint64_t handleNs = nowNs() - start;
+
+    printf("equality on \"%s\": strcmp %.1f ms, handles %.1f ms, %zu/%zu matches\n",
+           needle, textNs / 1e6, handleNs / 1e6, byText, byHandle);
+
+    return 0;
+}
@@ -0,0 +1,476 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Flyweight snapshots
+ * - A populated factory can be saved to a file and opened again by any number
+ *   of processes. Opening maps the file into memory and the factory is ready
+ *   at once: no flyweight is recreated and no table is rebuilt. The kernel
+ *   shares the pages among every process that maps the same file.
+ */
+
+/**
+ * This works because the factory always keeps all its state in one contiguous
+ * region, laid out exactly as the file is:
+ *
+ *   header | hash table | flyweight records
+ *
+ * Nothing in the region is a pointer. Table slots hold record indices and the
+ * header holds offsets from the start of the region, so the region means the
+ * same thing at whatever address it is mapped. Flyweight records hold only
+ * intrinsic state. The operation is supplied by the factory, because code
+ * addresses cannot be stored in a file.
+ *
+ * A mapped snapshot is read-only. The first getFlyweight for a key that is not
+ * in it copies the region to the heap, and from then on the factory behaves
+ * like one that was built in memory. Pointers to flyweights stay valid until
+ * the next flyweight is created.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Flyweight_s {
+    int64_t key;
+    int64_t intState;
+} Flyweight_t;
+
+#define SNAPSHOT_MAGIC "FLYWT\0\0\1"
+
+typedef struct SnapshotHeader_s {
+    char magic[8];
+    uint64_t regionSize;
+    uint64_t numFlyweights;
+    uint64_t capacity;          /* records the region has room for */
+    uint64_t tableSlots;        /* power of two */
+    uint64_t tableOffset;
+    uint64_t recordsOffset;
+} SnapshotHeader_t;
+
+typedef struct FlyweightFactory_s FlyweightFactory_t;
+
+struct FlyweightFactory_s {
+    unsigned char *region;
+    int mapped;                 /* region is a read-only file mapping */
+
+    Flyweight_t *(*getFlyweight)(FlyweightFactory_t *, int64_t);
+    int64_t (*operation)(const Flyweight_t *, int64_t extState);
+};
+
+int64_t flyweightOperation(const Flyweight_t *fw, int64_t extState)
+{
+    return fw->intState + extState;
+}
+
+static SnapshotHeader_t * header(const FlyweightFactory_t *f)
+{
+    return (SnapshotHeader_t *) f->region;
+}
+
+/* Slots hold a record index plus one, 0 marks an empty slot */
+static uint32_t * table(const FlyweightFactory_t *f)
+{
+    return (uint32_t *) (f->region + header(f)->tableOffset);
+}
+
+static Flyweight_t * records(const FlyweightFactory_t *f)
+{
+    return (Flyweight_t *) (f->region + header(f)->recordsOffset);
+}
+
+static inline uint64_t hashKey(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+static unsigned char * newRegion(uint64_t capacity)
+{
+    uint64_t tableSlots = 1024;
+
+    /* keep the table at most half full */
+    while (tableSlots < 2 * capacity) {
+        tableSlots *= 2;
+    }
+
+    uint64_t tableOffset = sizeof(SnapshotHeader_t);
+    uint64_t recordsOffset = tableOffset + tableSlots * sizeof(uint32_t);
+    uint64_t regionSize = recordsOffset + capacity * sizeof(Flyweight_t);
+    unsigned char *region = (unsigned char *) calloc(1, regionSize);
+    SnapshotHeader_t *h = (SnapshotHeader_t *) region;
+
+    memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+    h->regionSize = regionSize;
+    h->capacity = capacity;
+    h->tableSlots = tableSlots;
+    h->tableOffset = tableOffset;
+    h->recordsOffset = recordsOffset;
+
+    return region;
+}
+
+static void tableInsert(FlyweightFactory_t *f, uint64_t key, uint32_t index)
+{
+    uint32_t *slots = table(f);
+    uint64_t mask = header(f)->tableSlots - 1;
+    uint64_t k = hashKey(key) & mask;
+
+    while (slots[k]) {
+        k = (k + 1) & mask;
+    }
+    slots[k] = index + 1;
+}
+
+/*
+ * Move the flyweights into a new heap region with room for capacity records.
+ * This is both how a full factory grows and how a mapped snapshot becomes
+ * writable.
+ */
+static void moveToHeap(FlyweightFactory_t *f, uint64_t capacity)
+{
+    FlyweightFactory_t old = *f;
+    uint64_t n = header(&old)->numFlyweights;
+
+    f->region = newRegion(capacity);
+    f->mapped = 0;
+    header(f)->numFlyweights = n;
+    memcpy(records(f), records(&old), n * sizeof(Flyweight_t));
+
+    for (uint64_t k = 0; k < n; k++) {
+        tableInsert(f, (uint64_t) records(f)[k].key, (uint32_t) k);
+    }
+
+    if (old.mapped) {
+        munmap(old.region, header(&old)->regionSize);
+    } else {
+        free(old.region);
+    }
+}
+
+/*
+ * A mapped table comes from a file, so a slot may point past the records and
+ * the table may have no empty slot at all. Such slots are skipped and the probe
+ * gives up after visiting every slot once.
+ */
+static Flyweight_t * findFlyweight(const FlyweightFactory_t *f, int64_t key)
+{
+    const SnapshotHeader_t *h = header(f);
+    const uint32_t *slots = table(f);
+    uint64_t mask = h->tableSlots - 1;
+    uint64_t k = hashKey((uint64_t) key) & mask;
+
+    for (uint64_t probes = 0; probes < h->tableSlots && slots[k]; probes++) {
+        if (slots[k] - 1 < h->numFlyweights) {
+            Flyweight_t *fw = &records(f)[slots[k] - 1];
+
+            if (fw->key == key) {
+                return fw;
+            }
+        }
+        k = (k + 1) & mask;
+    }
+
+    return NULL;
+}
+
+Flyweight_t * getFlyweight(FlyweightFactory_t *f, int64_t key)
+{
+    SnapshotHeader_t *h = header(f);
+    Flyweight_t *fw = findFlyweight(f, key);
+
+    if (fw) {
+        return fw;
+    }
+
+    /* flyweight does not yet exist, create it */
+    if (f->mapped || h->numFlyweights == h->capacity) {
+        int wasMapped = f->mapped;
+
+        moveToHeap(f, h->capacity < 512 ? 1024 : 2 * h->capacity);
+        h = header(f);
+
+        /* the table was rebuilt from the records, so a bad slot cannot hide it */
+        if (wasMapped && (fw = findFlyweight(f, key))) {
+            return fw;
+        }
+    }
+
+    uint32_t index = (uint32_t) h->numFlyweights++;
+
+    fw = &records(f)[index];
+
+    fw->key = key;
+    fw->intState = 2 * key;
+    tableInsert(f, (uint64_t) key, index);
+
+    return fw;
+}
+
+FlyweightFactory_t * newFlyweightFactory(void)
+{
+    FlyweightFactory_t *f = (FlyweightFactory_t *) calloc(1, sizeof(FlyweightFactory_t));
+
+    f->region = newRegion(1024);
+
+    f->getFlyweight = getFlyweight;
+    f->operation = flyweightOperation;
+
+    return f;
+}
+
+/*
+ * The file is the region, cut short after the last record. It is written to a
+ * temporary name and renamed into place, so a reader never sees a partial
+ * snapshot.
+ */
+int saveSnapshot(const FlyweightFactory_t *f, const char *path)
+{
+    SnapshotHeader_t h = *header(f);
+    char tmp[4096];
+
+    h.capacity = h.numFlyweights;
+    h.regionSize = h.recordsOffset + h.numFlyweights * sizeof(Flyweight_t);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        perror(tmp);
+        return -1;
+    }
+
+    const unsigned char *p = f->region + sizeof(h);
+    size_t left = h.regionSize - sizeof(h);
+    int ok = write(fd, &h, sizeof(h)) == (ssize_t) sizeof(h);
+
+    while (ok && left > 0) {
+        ssize_t n = write(fd, p, left);
+
+        ok = n > 0;
+        p += n > 0 ? n : 0;
+        left -= n > 0 ? (size_t) n : 0;
+    }
+
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+
+    if (!ok || rename(tmp, path) != 0) {
+        perror(path);
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Check that everything the header points at is inside the file. The table and
+ * the records are bounded by the file size before their sizes are computed, so
+ * the sums below cannot overflow. The slots themselves are checked on lookup.
+ */
+static int validHeader(const SnapshotHeader_t *h, uint64_t fileSize)
+{
+    return memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0
+           && h->regionSize == fileSize
+           && h->tableSlots && (h->tableSlots & (h->tableSlots - 1)) == 0
+           && h->tableSlots <= fileSize / sizeof(uint32_t)
+           && h->capacity <= fileSize / sizeof(Flyweight_t)
+           && h->capacity < UINT32_MAX
+           && h->numFlyweights <= h->capacity
+           && h->numFlyweights < h->tableSlots
+           && h->tableOffset == sizeof(SnapshotHeader_t)
+           && h->recordsOffset == h->tableOffset + h->tableSlots * sizeof(uint32_t)
+           && h->recordsOffset + h->capacity * sizeof(Flyweight_t) <= fileSize;
+}
+
+FlyweightFactory_t * openSnapshot(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SnapshotHeader_t)) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    void *region = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (!validHeader((const SnapshotHeader_t *) region, (uint64_t) st.st_size)) {
+        fprintf(stderr, "%s: not a flyweight snapshot\n", path);
+        munmap(region, (size_t) st.st_size);
+        return NULL;
+    }
+
+    FlyweightFactory_t *f = (FlyweightFactory_t *) calloc(1, sizeof(FlyweightFactory_t));
+
+    f->region = (unsigned char *) region;
+    f->mapped = 1;
+
+    f->getFlyweight = getFlyweight;
+    f->operation = flyweightOperation;
+
+    return f;
+}
+
+void deleteFlyweightFactory(FlyweightFactory_t *f)
+{
+    if (f->mapped) {
+        munmap(f->region, header(f)->regionSize);
+    } else {
+        free(f->region);
+    }
+    free(f);
+}
+
+/*
+ * Benchmark: time until a process has 10M flyweights available, rebuilding them
+ * through getFlyweight against opening a snapshot, then the cost of a first
+ * round of lookups in each (for the snapshot, this is where pages are faulted
+ * in, if they are not already in the page cache).
+ */
+#define BENCH_FLYWEIGHTS 10000000
+#define BENCH_LOOKUPS 1000000
+
+static int64_t benchKey(uint64_t k)
+{
+    return (int64_t) (hashKey(k) >> 2);
+}
+
+static double lookupPass(FlyweightFactory_t *f, uint64_t *sum)
+{
+    uint64_t start = nowNs();
+
+    for (uint64_t k = 0; k < BENCH_LOOKUPS; k++) {
+        Flyweight_t *fw = f->getFlyweight(f, benchKey(hashKey(k) % BENCH_FLYWEIGHTS));
+
+        *sum += (uint64_t) f->operation(fw, (int64_t) k);
+    }
+
+    return (nowNs() - start) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "/tmp/flyweight.snapshot";
+    FlyweightFactory_t *f = newFlyweightFactory();
+
+    for (int k = 0; k < 10; k++) {
+        f->getFlyweight(f, k % 5);
+    }
+    saveSnapshot(f, path);
+    deleteFlyweightFactory(f);
+
+    f = openSnapshot(path);
+    printf("Snapshot holds %llu flyweights\n",
+           (unsigned long long) header(f)->numFlyweights);
+    for (int k = 0; k < 5; k++) {
+        Flyweight_t *fw = f->getFlyweight(f, k);
+
+        printf("Flyweight key=%lld, intrinsic state=%lld, operation(10)=%lld\n",
+               (long long) fw->key, (long long) fw->intState,
+               (long long) f->operation(fw, 10));
+    }
+    f->getFlyweight(f, 99);
+    printf("After adding key 99: %llu flyweights, %s\n",
+           (unsigned long long) header(f)->numFlyweights,
+           f->mapped ? "still mapped" : "copied to the heap");
+    deleteFlyweightFactory(f);
+
+    /* the same snapshot, with every table slot pointing past the records */
+    int fd = open(path, O_RDWR);
+    SnapshotHeader_t h;
+    int ok = fd >= 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h);
+    size_t tableBytes = ok ? h.tableSlots * sizeof(uint32_t) : 0;
+    unsigned char *garbage = (unsigned char *) malloc(tableBytes);
+
+    memset(garbage, 0xff, tableBytes);
+    ok = ok && pwrite(fd, garbage, tableBytes, (off_t) h.tableOffset)
+               == (ssize_t) tableBytes;
+    free(garbage);
+
+    f = ok ? openSnapshot(path) : NULL;
+    if (f) {
+        Flyweight_t *fw = f->getFlyweight(f, 3);
+
+        printf("Corrupt table: key %lld found, intrinsic state=%lld, %llu flyweights\n",
+               (long long) fw->key, (long long) fw->intState,
+               (unsigned long long) header(f)->numFlyweights);
+        deleteFlyweightFactory(f);
+    }
+
+    /* a header whose table would not fit in the file */
+    h.tableSlots = 1ull << 62;
+    ok = ok && pwrite(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h);
+    if (fd >= 0) {
+        close(fd);
+    }
+    printf("Oversized table: %s\n\n",
+           ok && !openSnapshot(path) ? "rejected" : "NOT REJECTED");
+
+    /* rebuild */
+    uint64_t rebuiltSum = 0, mappedSum = 0;
+    uint64_t start = nowNs();
+
+    f = newFlyweightFactory();
+    for (uint64_t k = 0; k < BENCH_FLYWEIGHTS; k++) {
+        f->getFlyweight(f, benchKey(k));
+    }
+
+    double rebuildMs = (nowNs() - start) / 1e6;
+    double rebuiltLookupMs = lookupPass(f, &rebuiltSum);
+
+    saveSnapshot(f, path);
+    deleteFlyweightFactory(f);
+
+    /* open */
+    start = nowNs();
+    f = openSnapshot(path);
+
+    double openMs = (nowNs() - start) / 1e6;
+    double mappedLookupMs = lookupPass(f, &mappedSum);
+
+    printf("%d flyweights, snapshot of %.1f MB\n", BENCH_FLYWEIGHTS,
+           header(f)->regionSize / 1e6);
+    printf("rebuild  %9.1f ms to ready, then %6.1f ms for %d lookups\n",
+           rebuildMs, rebuiltLookupMs, BENCH_LOOKUPS);
+    printf("mmap     %9.3f ms to ready, then %6.1f ms for %d lookups\n",
+           openMs, mappedLookupMs, BENCH_LOOKUPS);
+    printf("results %s, %s\n", rebuiltSum == mappedSum ? "identical" : "DIFFER",
+           f->mapped ? "snapshot still mapped" : "SNAPSHOT COPIED");
+
+    deleteFlyweightFactory(f);
+    unlink(path);
+
+    return 0;
+}
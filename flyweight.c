@@ -72,10 +72,12 @@ struct FlyweightFactory_s {
 
 Flyweight_t * getFlyweight(FlyweightFactory_t *f, int key)
 {
-    if (f->pool[key]) {
+    if (key < 0 || key >= FLYWEIGHT_POOL_SIZE) {
+        return NULL;
+    } else if (f->pool[key]) {
         /* flyweight exists */
         return f->pool[key];
-    } else if (key < FLYWEIGHT_POOL_SIZE) {
+    } else {
         /* flyweight does not yet exist, create it */
         Flyweight_t *fw = newFlyweight(key);
         f->pool[key] = fw;
@@ -83,14 +85,12 @@ Flyweight_t * getFlyweight(FlyweightFactory_t *f, int key)
         f->numFlyweights++;
 
         return f->pool[key];
-    } else {
-        return NULL;
     }
 }
 
 FlyweightFactory_t * newFlyweightFactory(void)
 {
-    FlyweightFactory_t *f = (FlyweightFactory_t *) malloc(sizeof(FlyweightFactory_t));
+    FlyweightFactory_t *f = (FlyweightFactory_t *) calloc(1, sizeof(FlyweightFactory_t));
 
     f->getFlyweight = getFlyweight;
 
@@ -0,0 +1,625 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Asynchronous mediator
+ * - In mediator.c a colleague's update calls the mediator, which calls the
+ *   next colleague's update, which calls the mediator again. A cascade through
+ *   N colleagues is N nested calls on one thread's stack.
+ * - Here the mediator posts the update to the receiving colleague's mailbox and
+ *   returns. A pool of worker threads runs the colleagues whose mailboxes have
+ *   messages in them, so every handler starts on an almost empty stack, and
+ *   colleagues further down a cascade can work while earlier ones receive the
+ *   next update.
+ */
+
+/**
+ * A colleague is handled by at most one worker at a time, so its handler never
+ * races with itself and sees its messages in the order they were posted. The
+ * `scheduled` flag, guarded by the mailbox lock, says that the colleague is
+ * queued on a worker or being run. Posting to an unscheduled colleague
+ * schedules it. The worker running it clears the flag only once it finds the
+ * mailbox empty, under the same lock.
+ *
+ * Each worker keeps its scheduled colleagues in a deque of its own. A
+ * colleague scheduled by a handler goes to the deque of that handler's
+ * worker, which takes work from the back, so a cascade stays on one worker
+ * while its data is in that worker's cache. An idle worker steals from the
+ * front of another worker's deque.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Stack depth probe: every handler records how far below its thread's starting
+ * point it runs.
+ */
+static _Thread_local uintptr_t stackBase;
+static atomic_size_t maxStackDepth;
+
+static void markStackBase(void)
+{
+    char marker;
+
+    stackBase = (uintptr_t) &marker;
+}
+
+static void probeStackDepth(void)
+{
+    char marker;
+    size_t depth = stackBase - (uintptr_t) &marker;
+    size_t seen = atomic_load_explicit(&maxStackDepth, memory_order_relaxed);
+
+    while (depth > seen &&
+           !atomic_compare_exchange_weak(&maxStackDepth, &seen, depth)) {
+    }
+}
+
+typedef struct Mediator_s Mediator_t;
+typedef struct Colleague_s Colleague_t;
+typedef struct Pool_s Pool_t;
+
+typedef struct Message_s {
+    Colleague_t *from;
+    long value;
+} Message_t;
+
+struct Mediator_s {
+    Colleague_t **colleagues;
+    size_t numColleagues;
+    size_t capacity;
+
+    Pool_t *pool;       /* NULL for the synchronous mediator */
+
+    void (*addColleague)(Mediator_t *, Colleague_t *);
+    void (*colleagueUpdate)(Mediator_t *, Colleague_t *, long value);
+};
+
+#define MAX_ID_LEN 16
+struct Colleague_s {
+    char id[MAX_ID_LEN];
+    size_t index;           /* position in the mediator */
+    Mediator_t *mediator;
+
+    /* mailbox, a growable ring */
+    pthread_mutex_t lock;
+    Message_t *mailbox;
+    size_t head;
+    size_t count;
+    size_t mailboxSize;
+    int scheduled;
+
+    /* touched by the colleague's handler only */
+    unsigned long handled;
+    long lastValue;
+
+    void (*update)(Colleague_t *, long value);
+    void (*receive)(Colleague_t *, Colleague_t *from, long value);
+};
+
+/*
+ * Work-stealing pool
+ */
+#define MAX_WORKERS 16
+#define HANDLER_BATCH 64    /* messages per turn before a colleague yields */
+
+typedef struct Worker_s {
+    pthread_mutex_t lock;
+    Colleague_t **deque;    /* owner works at the back, thieves at the front */
+    size_t front;
+    size_t back;
+    size_t capacity;
+
+    Pool_t *pool;
+    int index;
+    unsigned long steals;
+    pthread_t thread;
+} Worker_t;
+
+struct Pool_s {
+    Worker_t workers[MAX_WORKERS];
+    int numWorkers;
+
+    atomic_size_t queued;       /* colleagues sitting in some deque */
+    atomic_size_t pending;      /* messages posted but not yet handled */
+    atomic_uint nextInjection;  /* round robin for posts from outside */
+
+    pthread_mutex_t idleLock;
+    pthread_cond_t wake;
+    pthread_cond_t drained;
+    atomic_int sleeping;
+    int stopping;
+
+    void (*post)(Pool_t *, Colleague_t *to, Message_t);
+    void (*drain)(Pool_t *);
+    void (*shutdown)(Pool_t *);
+};
+
+static _Thread_local Worker_t *currentWorker;
+
+static void pushColleague(Worker_t *w, Colleague_t *c)
+{
+    Pool_t *pool = w->pool;
+
+    pthread_mutex_lock(&w->lock);
+
+    if (w->back == w->capacity) {
+        if (w->front > 0) {
+            memmove(w->deque, w->deque + w->front,
+                    (w->back - w->front) * sizeof(Colleague_t *));
+            w->back -= w->front;
+            w->front = 0;
+        } else {
+            w->capacity = w->capacity ? 2 * w->capacity : 64;
+            w->deque = (Colleague_t **) realloc(w->deque,
+                                                w->capacity * sizeof(Colleague_t *));
+        }
+    }
+    w->deque[w->back++] = c;
+
+    pthread_mutex_unlock(&w->lock);
+
+    atomic_fetch_add(&pool->queued, 1);
+
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->idleLock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->idleLock);
+    }
+}
+
+static Colleague_t * popColleague(Worker_t *w)
+{
+    Colleague_t *c = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->back > w->front) {
+        c = w->deque[--w->back];
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return c;
+}
+
+static Colleague_t * stealColleague(Worker_t *thief)
+{
+    Pool_t *pool = thief->pool;
+
+    for (int k = 1; k < pool->numWorkers; k++) {
+        Worker_t *victim = &pool->workers[(thief->index + k) % pool->numWorkers];
+        Colleague_t *c = NULL;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->back > victim->front) {
+            c = victim->deque[victim->front++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (c) {
+            thief->steals++;
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+void poolPost(Pool_t *pool, Colleague_t *to, Message_t msg)
+{
+    int schedule;
+
+    atomic_fetch_add(&pool->pending, 1);
+
+    pthread_mutex_lock(&to->lock);
+
+    if (to->count == to->mailboxSize) {
+        size_t size = to->mailboxSize ? 2 * to->mailboxSize : 4;
+        Message_t *mailbox = (Message_t *) malloc(size * sizeof(Message_t));
+
+        for (size_t k = 0; k < to->count; k++) {
+            mailbox[k] = to->mailbox[(to->head + k) % to->mailboxSize];
+        }
+        free(to->mailbox);
+        to->mailbox = mailbox;
+        to->mailboxSize = size;
+        to->head = 0;
+    }
+    to->mailbox[(to->head + to->count++) % to->mailboxSize] = msg;
+
+    schedule = !to->scheduled;
+    to->scheduled = 1;
+
+    pthread_mutex_unlock(&to->lock);
+
+    if (schedule) {
+        Worker_t *w = currentWorker;
+
+        if (!w || w->pool != pool) {
+            w = &pool->workers[atomic_fetch_add(&pool->nextInjection, 1)
+                               % (unsigned) pool->numWorkers];
+        }
+        pushColleague(w, to);
+    }
+}
+
+/* Handle up to HANDLER_BATCH messages, then let other colleagues have a turn */
+static void runColleague(Worker_t *w, Colleague_t *c)
+{
+    Pool_t *pool = w->pool;
+
+    for (int n = 0; ; n++) {
+        Message_t msg;
+
+        pthread_mutex_lock(&c->lock);
+
+        if (c->count == 0) {
+            c->scheduled = 0;
+            pthread_mutex_unlock(&c->lock);
+            return;
+        }
+
+        if (n == HANDLER_BATCH) {
+            /* still scheduled, so nobody else picks it up in between */
+            pthread_mutex_unlock(&c->lock);
+            pushColleague(w, c);
+            return;
+        }
+
+        msg = c->mailbox[c->head];
+        c->head = (c->head + 1) % c->mailboxSize;
+        c->count--;
+
+        pthread_mutex_unlock(&c->lock);
+
+        c->receive(c, msg.from, msg.value);
+
+        if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+            pthread_mutex_lock(&pool->idleLock);
+            pthread_cond_broadcast(&pool->drained);
+            pthread_mutex_unlock(&pool->idleLock);
+        }
+    }
+}
+
+static void * workerThread(void *arg)
+{
+    Worker_t *w = (Worker_t *) arg;
+    Pool_t *pool = w->pool;
+
+    currentWorker = w;
+    markStackBase();
+
+    for (;;) {
+        Colleague_t *c = popColleague(w);
+
+        if (!c) {
+            c = stealColleague(w);
+        }
+
+        if (c) {
+            atomic_fetch_sub(&pool->queued, 1);
+            runColleague(w, c);
+            continue;
+        }
+
+        /* nothing anywhere: sleep until a colleague is pushed */
+        pthread_mutex_lock(&pool->idleLock);
+        atomic_fetch_add(&pool->sleeping, 1);
+
+        while (atomic_load(&pool->queued) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->idleLock);
+        }
+
+        atomic_fetch_sub(&pool->sleeping, 1);
+
+        int stop = pool->stopping && atomic_load(&pool->queued) == 0;
+
+        pthread_mutex_unlock(&pool->idleLock);
+
+        if (stop) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Wait until every posted message, and everything it caused, is handled */
+void poolDrain(Pool_t *pool)
+{
+    pthread_mutex_lock(&pool->idleLock);
+    while (atomic_load(&pool->pending) > 0) {
+        pthread_cond_wait(&pool->drained, &pool->idleLock);
+    }
+    pthread_mutex_unlock(&pool->idleLock);
+}
+
+void poolShutdown(Pool_t *pool)
+{
+    pthread_mutex_lock(&pool->idleLock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->idleLock);
+
+    for (int k = 0; k < pool->numWorkers; k++) {
+        pthread_join(pool->workers[k].thread, NULL);
+    }
+}
+
+Pool_t * newPool(int numWorkers)
+{
+    Pool_t *pool = (Pool_t *) calloc(1, sizeof(Pool_t));
+
+    pthread_mutex_init(&pool->idleLock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->drained, NULL);
+
+    pool->post = poolPost;
+    pool->drain = poolDrain;
+    pool->shutdown = poolShutdown;
+
+    pool->numWorkers = numWorkers;
+    for (int k = 0; k < numWorkers; k++) {
+        pthread_mutex_init(&pool->workers[k].lock, NULL);
+        pool->workers[k].pool = pool;
+        pool->workers[k].index = k;
+    }
+    for (int k = 0; k < numWorkers; k++) {
+        pthread_create(&pool->workers[k].thread, NULL, workerThread,
+                       &pool->workers[k]);
+    }
+
+    return pool;
+}
+
+/*
+ * Mediators
+ */
+void mediatorAddColleague(Mediator_t *m, Colleague_t *c)
+{
+    if (m->numColleagues == m->capacity) {
+        m->capacity = m->capacity ? 2 * m->capacity : 8;
+        m->colleagues = (Colleague_t **) realloc(m->colleagues,
+                                                 m->capacity * sizeof(Colleague_t *));
+    }
+
+    c->index = m->numColleagues;
+    m->colleagues[m->numColleagues++] = c;
+}
+
+/* As in mediator.c, an update goes on to the colleague added after the sender */
+static Colleague_t * nextColleague(Mediator_t *m, Colleague_t *c)
+{
+    return c->index + 1 < m->numColleagues ? m->colleagues[c->index + 1] : NULL;
+}
+
+void syncColleagueUpdate(Mediator_t *m, Colleague_t *c, long value)
+{
+    Colleague_t *next = nextColleague(m, c);
+
+    if (next) {
+        next->receive(next, c, value);
+    }
+}
+
+void asyncColleagueUpdate(Mediator_t *m, Colleague_t *c, long value)
+{
+    Colleague_t *next = nextColleague(m, c);
+
+    if (next) {
+        m->pool->post(m->pool, next, (Message_t) { c, value });
+    }
+}
+
+Mediator_t * newMediator(Pool_t *pool)
+{
+    Mediator_t *m = (Mediator_t *) calloc(1, sizeof(Mediator_t));
+
+    m->pool = pool;
+
+    m->addColleague = mediatorAddColleague;
+    m->colleagueUpdate = pool ? asyncColleagueUpdate : syncColleagueUpdate;
+
+    return m;
+}
+
+/*
+ * Colleagues
+ */
+void colleagueUpdate(Colleague_t *c, long value)
+{
+    c->mediator->colleagueUpdate(c->mediator, c, value);
+}
+
+/* A stand-in for real work, then the change is passed on */
+#define WORK_ROUNDS 200
+
+void colleagueReceive(Colleague_t *c, Colleague_t *from, long value)
+{
+    uint64_t h = (uint64_t) value;
+
+    (void) from;
+
+    probeStackDepth();
+
+    for (int r = 0; r < WORK_ROUNDS; r++) {
+        h = h * 6364136223846793005ull + 1442695040888963407ull;
+    }
+
+    c->handled++;
+    c->lastValue = value + (long) (h >> 63);
+
+    c->update(c, value + 1);
+}
+
+void colleagueReceiveVerbose(Colleague_t *c, Colleague_t *from, long value)
+{
+    printf("COLLEAGUE %s got %ld from COLLEAGUE %s\n", c->id, value, from->id);
+
+    c->handled++;
+    c->lastValue = value;
+
+    c->update(c, value + 1);
+}
+
+Colleague_t * newColleague(const char *id, Mediator_t *m)
+{
+    Colleague_t *c = (Colleague_t *) calloc(1, sizeof(Colleague_t));
+
+    snprintf(c->id, MAX_ID_LEN, "%s", id);
+    c->mediator = m;
+    pthread_mutex_init(&c->lock, NULL);
+
+    c->update = colleagueUpdate;
+    c->receive = colleagueReceive;
+
+    m->addColleague(m, c);
+
+    return c;
+}
+
+/*
+ * Benchmark: a cascade through CASCADE_LEN colleagues, C0 -> C1 -> ... The
+ * synchronous mediator needs a stack for all of it at once, so it gets a
+ * thread with a large stack. For throughput, WAVES cascades are started one
+ * after another at C0 and follow each other down the chain.
+ *
+ * MEDIATOR_CASCADE_LEN overrides the length. A ThreadSanitizer build cannot
+ * follow the synchronous recursion that deep, so there it defaults to 10000.
+ */
+#ifdef __SANITIZE_THREAD__
+#define CASCADE_LEN 10000
+#else
+#define CASCADE_LEN 100000
+#endif
+#define WAVES 8
+#define SYNC_STACK_BYTES (512u << 20)
+
+static Mediator_t * newChain(Pool_t *pool, int cascadeLen)
+{
+    Mediator_t *m = newMediator(pool);
+    char id[MAX_ID_LEN];
+
+    for (int k = 0; k < cascadeLen; k++) {
+        snprintf(id, sizeof(id), "C%d", k);
+        newColleague(id, m);
+    }
+
+    return m;
+}
+
+static unsigned long chainHandled(const Mediator_t *m)
+{
+    unsigned long handled = 0;
+
+    for (size_t k = 0; k < m->numColleagues; k++) {
+        handled += m->colleagues[k]->handled;
+    }
+
+    return handled;
+}
+
+static void * runSyncCascade(void *arg)
+{
+    Mediator_t *m = (Mediator_t *) arg;
+    Colleague_t *first = m->colleagues[0];
+
+    markStackBase();
+    for (int wave = 0; wave < WAVES; wave++) {
+        first->update(first, 0);
+    }
+
+    return NULL;
+}
+
+static void runBenchmark(int cascadeLen)
+{
+    unsigned long expected = (unsigned long) WAVES * (cascadeLen - 1);
+    Mediator_t *m = newChain(NULL, cascadeLen);
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SYNC_STACK_BYTES);
+    atomic_store(&maxStackDepth, 0);
+
+    uint64_t start = nowNs();
+    pthread_create(&thread, &attr, runSyncCascade, m);
+    pthread_join(thread, NULL);
+    uint64_t syncNs = nowNs() - start;
+
+    printf("%d waves through a %d-colleague cascade (%ld cores online)\n",
+           WAVES, cascadeLen, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("sync        %7.1f ms  %6.2f M updates/s  max stack %9zu bytes%s\n",
+           syncNs / 1e6, expected / (syncNs / 1e3), atomic_load(&maxStackDepth),
+           chainHandled(m) == expected ? "" : "  (WRONG COUNT)");
+
+    for (int workers = 1; workers <= 8; workers *= 2) {
+        Pool_t *pool = newPool(workers);
+        unsigned long steals = 0;
+
+        m = newChain(pool, cascadeLen);
+        atomic_store(&maxStackDepth, 0);
+
+        start = nowNs();
+        for (int wave = 0; wave < WAVES; wave++) {
+            m->colleagues[0]->update(m->colleagues[0], 0);
+        }
+        pool->drain(pool);
+        uint64_t asyncNs = nowNs() - start;
+
+        pool->shutdown(pool);
+        for (int k = 0; k < workers; k++) {
+            steals += pool->workers[k].steals;
+        }
+
+        printf("async %dw    %7.1f ms  %6.2f M updates/s  max stack %9zu bytes"
+               "  %.2fx sync  %lu steals%s\n", workers, asyncNs / 1e6,
+               expected / (asyncNs / 1e3), atomic_load(&maxStackDepth),
+               (double) syncNs / asyncNs, steals,
+               chainHandled(m) == expected ? "" : "  (WRONG COUNT)");
+    }
+}
+
+int main(void)
+{
+    Pool_t *pool = newPool(2);
+    Mediator_t *m = newMediator(pool);
+
+    Colleague_t *c1 = newColleague("C1", m);
+    Colleague_t *c2 = newColleague("C2", m);
+    Colleague_t *c3 = newColleague("C3", m);
+
+    c1->receive = c2->receive = c3->receive = colleagueReceiveVerbose;
+
+    printf("Expecting nobody to get C3's update\n");
+    c3->update(c3, 1);
+    pool->drain(pool);
+
+    printf("\nExpecting C2, then C3 to get C1's update\n");
+    c1->update(c1, 1);
+    pool->drain(pool);
+    pool->shutdown(pool);
+
+    const char *len = getenv("MEDIATOR_CASCADE_LEN");
+
+    printf("\n");
+    runBenchmark(len ? atoi(len) : CASCADE_LEN);
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Topic-indexed mediator
+ * - Colleagues subscribe to topics. When a colleague publishes an update on a
+ *   topic, the mediator delivers it to the colleagues subscribed to that topic
+ *   and to nobody else.
+ * - The mediator keeps an index from topic to subscribers, so routing an
+ *   update costs time in proportion to the number of interested colleagues,
+ *   however many colleagues there are in total. Both the index and the
+ *   subscriber lists grow as needed.
+ */
+
+/**
+ * The benchmark also has a scanning mediator, which keeps every colleague in a
+ * single list and asks each one whether it is interested. That is what a
+ * mediator with a flat colleague array has to do once colleagues differ in
+ * what they care about.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Mediator_s Mediator_t;
+typedef struct Colleague_s Colleague_t;
+typedef int Topic_t;
+
+/* A growable array of colleague pointers */
+typedef struct ColleagueList_s {
+    Colleague_t **items;
+    size_t count;
+    size_t capacity;
+} ColleagueList_t;
+
+static void listAppend(ColleagueList_t *list, Colleague_t *c)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 4;
+        list->items = (Colleague_t **) realloc(list->items,
+                                               list->capacity * sizeof(Colleague_t *));
+    }
+
+    list->items[list->count++] = c;
+}
+
+struct Mediator_s {
+    /* all colleagues, used by the scanning mediator */
+    ColleagueList_t colleagues;
+
+    /* subscribers of every topic, used by the indexed mediator */
+    ColleagueList_t *topics;
+    size_t numTopics;
+
+    void (*addColleague)(Mediator_t *, Colleague_t *);
+    void (*subscribe)(Mediator_t *, Colleague_t *, Topic_t);
+    void (*colleagueUpdate)(Mediator_t *, Colleague_t *, Topic_t, long value);
+};
+
+#define MAX_ID_LEN 16
+struct Colleague_s {
+    char id[MAX_ID_LEN];
+    Mediator_t *mediator;
+
+    /* the scanning mediator checks these */
+    Topic_t *subscriptions;
+    size_t numSubscriptions;
+    size_t maxSubscriptions;
+
+    unsigned long received;
+    long lastValue;
+
+    void (*update)(Colleague_t *, Topic_t, long value);
+    void (*receive)(Colleague_t *, Colleague_t *from, Topic_t, long value);
+};
+
+void mediatorAddColleague(Mediator_t *m, Colleague_t *c)
+{
+    listAppend(&m->colleagues, c);
+}
+
+static int isSubscribed(const Colleague_t *c, Topic_t topic)
+{
+    for (size_t k = 0; k < c->numSubscriptions; k++) {
+        if (c->subscriptions[k] == topic) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void mediatorSubscribe(Mediator_t *m, Colleague_t *c, Topic_t topic)
+{
+    if (topic < 0 || isSubscribed(c, topic)) {
+        return;
+    }
+
+    if ((size_t) topic >= m->numTopics) {
+        size_t numTopics = m->numTopics ? m->numTopics : 16;
+
+        while (numTopics <= (size_t) topic) {
+            numTopics *= 2;
+        }
+
+        m->topics = (ColleagueList_t *) realloc(m->topics,
+                                                numTopics * sizeof(ColleagueList_t));
+        memset(m->topics + m->numTopics, 0,
+               (numTopics - m->numTopics) * sizeof(ColleagueList_t));
+        m->numTopics = numTopics;
+    }
+
+    listAppend(&m->topics[topic], c);
+
+    if (c->numSubscriptions == c->maxSubscriptions) {
+        c->maxSubscriptions = c->maxSubscriptions ? 2 * c->maxSubscriptions : 2;
+        c->subscriptions = (Topic_t *) realloc(c->subscriptions,
+                                               c->maxSubscriptions * sizeof(Topic_t));
+    }
+    c->subscriptions[c->numSubscriptions++] = topic;
+}
+
+void indexedColleagueUpdate(Mediator_t *m, Colleague_t *from, Topic_t topic,
+                            long value)
+{
+    if (topic < 0 || (size_t) topic >= m->numTopics) {
+        return;     /* nobody has ever subscribed */
+    }
+
+    ColleagueList_t *subscribers = &m->topics[topic];
+
+    for (size_t k = 0; k < subscribers->count; k++) {
+        Colleague_t *c = subscribers->items[k];
+
+        if (c != from) {
+            c->receive(c, from, topic, value);
+        }
+    }
+}
+
+void scanningColleagueUpdate(Mediator_t *m, Colleague_t *from, Topic_t topic,
+                             long value)
+{
+    for (size_t k = 0; k < m->colleagues.count; k++) {
+        Colleague_t *c = m->colleagues.items[k];
+
+        if (c != from && isSubscribed(c, topic)) {
+            c->receive(c, from, topic, value);
+        }
+    }
+}
+
+Mediator_t * newMediator(int indexed)
+{
+    Mediator_t *m = (Mediator_t *) calloc(1, sizeof(Mediator_t));
+
+    m->addColleague = mediatorAddColleague;
+    m->subscribe = mediatorSubscribe;
+    m->colleagueUpdate = indexed ? indexedColleagueUpdate
+                                 : scanningColleagueUpdate;
+
+    return m;
+}
+
+void colleagueUpdate(Colleague_t *c, Topic_t topic, long value)
+{
+    c->mediator->colleagueUpdate(c->mediator, c, topic, value);
+}
+
+void colleagueReceive(Colleague_t *c, Colleague_t *from, Topic_t topic,
+                      long value)
+{
+    (void) from;
+    (void) topic;
+
+    c->received++;
+    c->lastValue = value;
+}
+
+void colleagueReceiveVerbose(Colleague_t *c, Colleague_t *from, Topic_t topic,
+                             long value)
+{
+    printf("COLLEAGUE %s got %ld on topic %d from COLLEAGUE %s\n",
+           c->id, value, topic, from->id);
+    colleagueReceive(c, from, topic, value);
+}
+
+Colleague_t * newColleague(const char *id, Mediator_t *m)
+{
+    Colleague_t *c = (Colleague_t *) calloc(1, sizeof(Colleague_t));
+
+    snprintf(c->id, MAX_ID_LEN, "%s", id);
+    c->mediator = m;
+
+    c->update = colleagueUpdate;
+    c->receive = colleagueReceive;
+
+    m->addColleague(m, c);
+
+    return c;
+}
+
+/*
+ * Benchmark: colleagues each subscribe to up to two of NUM_TOPICS topics, then
+ * updates are published on random topics by random colleagues. The two
+ * mediators must deliver the same number of updates.
+ */
+#define NUM_TOPICS 1000
+#define BENCH_UPDATES 5000
+
+static void runBenchmark(int numColleagues)
+{
+    double nsPerUpdate[2];
+    unsigned long delivered[2];
+
+    for (int indexed = 0; indexed <= 1; indexed++) {
+        Mediator_t *m = newMediator(indexed);
+        Colleague_t **colleagues = (Colleague_t **) malloc(numColleagues * sizeof(Colleague_t *));
+        unsigned seed = 29;
+        char id[MAX_ID_LEN];
+
+        for (int k = 0; k < numColleagues; k++) {
+            snprintf(id, sizeof(id), "C%d", k);
+            colleagues[k] = newColleague(id, m);
+
+            for (int s = 0; s < 2; s++) {
+                seed = seed * 1103515245u + 12345u;
+                m->subscribe(m, colleagues[k], (Topic_t) ((seed >> 8) % NUM_TOPICS));
+            }
+        }
+
+        uint64_t start = nowNs();
+
+        for (int k = 0; k < BENCH_UPDATES; k++) {
+            seed = seed * 1103515245u + 12345u;
+
+            Colleague_t *from = colleagues[(seed >> 4) % (unsigned) numColleagues];
+
+            from->update(from, (Topic_t) ((seed >> 12) % NUM_TOPICS), k);
+        }
+
+        nsPerUpdate[indexed] = (double) (nowNs() - start) / BENCH_UPDATES;
+        delivered[indexed] = 0;
+        for (int k = 0; k < numColleagues; k++) {
+            delivered[indexed] += colleagues[k]->received;
+        }
+    }
+
+    printf("%7d colleagues  scan %10.0f ns/update  index %6.0f ns/update"
+           "  (%.0fx)  %s\n", numColleagues, nsPerUpdate[0], nsPerUpdate[1],
+           nsPerUpdate[0] / nsPerUpdate[1],
+           delivered[0] == delivered[1] ? "same deliveries" : "DELIVERIES DIFFER");
+}
+
+int main(void)
+{
+    Mediator_t *m = newMediator(1);
+    Colleague_t *c1 = newColleague("C1", m);
+    Colleague_t *c2 = newColleague("C2", m);
+    Colleague_t *c3 = newColleague("C3", m);
+    enum { TEMPERATURE, PRESSURE };
+
+    c1->receive = c2->receive = c3->receive = colleagueReceiveVerbose;
+
+    m->subscribe(m, c2, TEMPERATURE);
+    m->subscribe(m, c3, TEMPERATURE);
+    m->subscribe(m, c3, PRESSURE);
+
+    printf("Expecting C2 and C3 to get the temperature\n");
+    c1->update(c1, TEMPERATURE, 21);
+
+    printf("\nExpecting C3 ONLY to get the pressure\n");
+    c1->update(c1, PRESSURE, 1013);
+
+    printf("\nExpecting C3 ONLY to get C2's temperature\n");
+    c2->update(c2, TEMPERATURE, 22);
+
+    printf("\n");
+    for (int n = 1000; n <= 100000; n *= 10) {
+        runBenchmark(n);
+    }
+
+    return 0;
+}
@@ -0,0 +1,483 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Coalescing mediator
+ * - Colleagues depend on each other: a colleague's value is computed from the
+ *   values of the colleagues upstream of it. The mediator knows the
+ *   dependencies, so colleagues never refer to each other.
+ * - The immediate mediator works like mediator.c. Every change is passed on
+ *   at once, so a colleague reachable along several paths, or from several
+ *   colleagues that change together, is updated once per path.
+ * - The coalescing mediator collects the changes of a wave in a worklist and
+ *   updates every affected colleague exactly once, after all of its upstream
+ *   colleagues are up to date.
+ */
+
+/**
+ * The colleagues are ranked in topological order, so that every colleague
+ * ranks after everything upstream of it. The worklist is a heap ordered by
+ * rank. Taking the lowest rank next means a colleague is only updated when
+ * nothing that could still change its inputs is left in the worklist. A
+ * colleague that is already in the worklist for this wave is not added again.
+ * The ranks are recomputed when a wave begins after the dependencies have
+ * changed. If they change during a wave, the ranks are recomputed before the
+ * wave is delivered and the worklist is rebuilt, since the colleagues already
+ * in it were placed by their old ranks.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct Mediator_s Mediator_t;
+typedef struct Colleague_s Colleague_t;
+
+/* A growable array of colleague pointers */
+typedef struct ColleagueList_s {
+    Colleague_t **items;
+    size_t count;
+    size_t capacity;
+} ColleagueList_t;
+
+static void listAppend(ColleagueList_t *list, Colleague_t *c)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 4;
+        list->items = (Colleague_t **) realloc(list->items,
+                                               list->capacity * sizeof(Colleague_t *));
+    }
+
+    list->items[list->count++] = c;
+}
+
+struct Mediator_s {
+    ColleagueList_t colleagues;
+    int ranksStale;
+
+    /* the current wave */
+    int waveDepth;
+    unsigned long wave;
+    ColleagueList_t worklist;   /* a heap on rank */
+
+    unsigned long updates;      /* colleague updates, over all waves */
+
+    void (*addColleague)(Mediator_t *, Colleague_t *);
+    void (*addDependency)(Mediator_t *, Colleague_t *from, Colleague_t *to);
+    void (*colleagueChanged)(Mediator_t *, Colleague_t *);
+    void (*beginWave)(Mediator_t *);
+    void (*endWave)(Mediator_t *);
+};
+
+#define MAX_ID_LEN 16
+struct Colleague_s {
+    char id[MAX_ID_LEN];
+    Mediator_t *mediator;
+
+    uint64_t input;     /* set from outside */
+    uint64_t value;     /* input plus the values of the upstream colleagues */
+
+    /* maintained by the mediator */
+    ColleagueList_t upstream;
+    ColleagueList_t downstream;
+    size_t rank;
+    unsigned long queuedInWave;
+
+    void (*set)(Colleague_t *, uint64_t input);
+    void (*update)(Colleague_t *);
+};
+
+/*
+ * Worklist heap
+ */
+static void heapPush(ColleagueList_t *heap, Colleague_t *c)
+{
+    size_t k = heap->count;
+
+    listAppend(heap, c);
+
+    while (k > 0 && heap->items[(k - 1) / 2]->rank > c->rank) {
+        heap->items[k] = heap->items[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    heap->items[k] = c;
+}
+
+static Colleague_t * heapPop(ColleagueList_t *heap)
+{
+    Colleague_t *top = heap->items[0];
+    Colleague_t *last = heap->items[--heap->count];
+    size_t k = 0;
+
+    for (;;) {
+        size_t child = 2 * k + 1;
+
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count &&
+            heap->items[child + 1]->rank < heap->items[child]->rank) {
+            child++;
+        }
+        if (heap->items[child]->rank >= last->rank) {
+            break;
+        }
+
+        heap->items[k] = heap->items[child];
+        k = child;
+    }
+    heap->items[k] = last;
+
+    return top;
+}
+
+/*
+ * Topological ranks, by Kahn's algorithm. Returns 0 if the dependencies have a
+ * cycle.
+ */
+static int rankColleagues(Mediator_t *m)
+{
+    size_t n = m->colleagues.count;
+    size_t *waitingFor = (size_t *) malloc(n * sizeof(size_t));
+    Colleague_t **order = (Colleague_t **) malloc(n * sizeof(Colleague_t *));
+    size_t head = 0, tail = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        Colleague_t *c = m->colleagues.items[k];
+
+        c->rank = k;    /* used as an index until ranked */
+        waitingFor[k] = c->upstream.count;
+        if (waitingFor[k] == 0) {
+            order[tail++] = c;
+        }
+    }
+
+    while (head < tail) {
+        Colleague_t *c = order[head++];
+
+        for (size_t k = 0; k < c->downstream.count; k++) {
+            Colleague_t *d = c->downstream.items[k];
+
+            if (--waitingFor[d->rank] == 0) {
+                order[tail++] = d;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < tail; k++) {
+        order[k]->rank = k;
+    }
+
+    free(waitingFor);
+    free(order);
+
+    m->ranksStale = tail != n;
+
+    return tail == n;
+}
+
+void mediatorAddColleague(Mediator_t *m, Colleague_t *c)
+{
+    listAppend(&m->colleagues, c);
+    m->ranksStale = 1;
+}
+
+void mediatorAddDependency(Mediator_t *m, Colleague_t *from, Colleague_t *to)
+{
+    listAppend(&from->downstream, to);
+    listAppend(&to->upstream, from);
+    m->ranksStale = 1;
+}
+
+/*
+ * Immediate mediator: update the changed colleague and pass the change on
+ * along every dependency, depth first.
+ */
+void immediateColleagueChanged(Mediator_t *m, Colleague_t *c)
+{
+    c->update(c);
+    m->updates++;
+
+    for (size_t k = 0; k < c->downstream.count; k++) {
+        m->colleagueChanged(m, c->downstream.items[k]);
+    }
+}
+
+void immediateBeginWave(Mediator_t *m)
+{
+    (void) m;
+}
+
+void immediateEndWave(Mediator_t *m)
+{
+    (void) m;
+}
+
+/*
+ * Coalescing mediator
+ */
+
+/* Returns 0 if the dependencies have a cycle */
+static int refreshRanks(Mediator_t *m)
+{
+    if (!m->ranksStale) {
+        return 1;
+    }
+
+    if (!rankColleagues(m)) {
+        return 0;
+    }
+
+    /* re-push whatever was queued under the old ranks */
+    size_t queued = m->worklist.count;
+
+    m->worklist.count = 0;
+    for (size_t k = 0; k < queued; k++) {
+        heapPush(&m->worklist, m->worklist.items[k]);
+    }
+
+    return 1;
+}
+
+void coalescingBeginWave(Mediator_t *m)
+{
+    if (m->waveDepth++ == 0) {
+        m->wave++;
+        refreshRanks(m);
+    }
+}
+
+static void enqueue(Mediator_t *m, Colleague_t *c)
+{
+    if (c->queuedInWave != m->wave) {
+        c->queuedInWave = m->wave;
+        heapPush(&m->worklist, c);
+    }
+}
+
+void coalescingEndWave(Mediator_t *m)
+{
+    if (--m->waveDepth > 0) {
+        return;
+    }
+
+    if (!refreshRanks(m)) {
+        fprintf(stderr, "MEDIATOR dependencies have a cycle, wave dropped\n");
+        m->worklist.count = 0;
+        return;
+    }
+
+    while (m->worklist.count > 0) {
+        Colleague_t *c = heapPop(&m->worklist);
+
+        c->update(c);
+        m->updates++;
+
+        for (size_t k = 0; k < c->downstream.count; k++) {
+            enqueue(m, c->downstream.items[k]);
+        }
+    }
+}
+
+/* A change outside of beginWave/endWave is a wave of its own */
+void coalescingColleagueChanged(Mediator_t *m, Colleague_t *c)
+{
+    m->beginWave(m);
+    enqueue(m, c);
+    m->endWave(m);
+}
+
+Mediator_t * newMediator(int coalesce)
+{
+    Mediator_t *m = (Mediator_t *) calloc(1, sizeof(Mediator_t));
+
+    m->addColleague = mediatorAddColleague;
+    m->addDependency = mediatorAddDependency;
+
+    if (coalesce) {
+        m->colleagueChanged = coalescingColleagueChanged;
+        m->beginWave = coalescingBeginWave;
+        m->endWave = coalescingEndWave;
+    } else {
+        m->colleagueChanged = immediateColleagueChanged;
+        m->beginWave = immediateBeginWave;
+        m->endWave = immediateEndWave;
+    }
+
+    return m;
+}
+
+/*
+ * Colleagues
+ */
+void colleagueSet(Colleague_t *c, uint64_t input)
+{
+    c->input = input;
+    c->mediator->colleagueChanged(c->mediator, c);
+}
+
+void colleagueUpdate(Colleague_t *c)
+{
+    uint64_t value = c->input;
+
+    for (size_t k = 0; k < c->upstream.count; k++) {
+        value += c->upstream.items[k]->value;
+    }
+
+    c->value = value;
+}
+
+void colleagueUpdateVerbose(Colleague_t *c)
+{
+    colleagueUpdate(c);
+    printf("COLLEAGUE %s updated to %lu\n", c->id, (unsigned long) c->value);
+}
+
+Colleague_t * newColleague(const char *id, Mediator_t *m)
+{
+    Colleague_t *c = (Colleague_t *) calloc(1, sizeof(Colleague_t));
+
+    snprintf(c->id, MAX_ID_LEN, "%s", id);
+    c->mediator = m;
+
+    c->set = colleagueSet;
+    c->update = colleagueUpdate;
+
+    m->addColleague(m, c);
+
+    return c;
+}
+
+/*
+ * Benchmark: LAYERS layers of WIDTH colleagues, every colleague depending on
+ * all colleagues of the layer above, so each pair of adjacent layers is a
+ * set of diamonds. All colleagues of the top layer change together in one
+ * wave. Immediately, a colleague in layer k (from 0) is updated WIDTH^k times per
+ * wave; coalesced, once.
+ */
+#define WIDTH 3
+#define MAX_LAYERS 12
+#define BENCH_WAVES 4
+
+static Colleague_t ** newLattice(Mediator_t *m, int layers)
+{
+    Colleague_t **lattice = (Colleague_t **) malloc(layers * WIDTH * sizeof(Colleague_t *));
+    char id[MAX_ID_LEN];
+
+    for (int l = 0; l < layers; l++) {
+        for (int k = 0; k < WIDTH; k++) {
+            snprintf(id, sizeof(id), "L%dC%d", l, k);
+            lattice[l * WIDTH + k] = newColleague(id, m);
+
+            for (int u = 0; l > 0 && u < WIDTH; u++) {
+                m->addDependency(m, lattice[(l - 1) * WIDTH + u],
+                                 lattice[l * WIDTH + k]);
+            }
+        }
+    }
+
+    return lattice;
+}
+
+static void runBenchmark(int layers)
+{
+    unsigned long updates[2];
+    uint64_t elapsed[2];
+    uint64_t bottom[2];
+
+    for (int coalesce = 0; coalesce <= 1; coalesce++) {
+        Mediator_t *m = newMediator(coalesce);
+        Colleague_t **lattice = newLattice(m, layers);
+
+        uint64_t start = nowNs();
+
+        for (int wave = 1; wave <= BENCH_WAVES; wave++) {
+            m->beginWave(m);
+            for (int k = 0; k < WIDTH; k++) {
+                lattice[k]->set(lattice[k], (uint64_t) (wave * WIDTH + k));
+            }
+            m->endWave(m);
+        }
+
+        elapsed[coalesce] = nowNs() - start;
+        updates[coalesce] = m->updates;
+        bottom[coalesce] = lattice[(layers - 1) * WIDTH]->value;
+    }
+
+    printf("%2d layers  immediate %9lu updates %9.3f ms  coalesced %4lu updates"
+           " %6.3f ms  %s\n", layers, updates[0], elapsed[0] / 1e6, updates[1],
+           elapsed[1] / 1e6, bottom[0] == bottom[1] ? "same values" : "VALUES DIFFER");
+}
+
+int main(void)
+{
+    for (int coalesce = 0; coalesce <= 1; coalesce++) {
+        Mediator_t *m = newMediator(coalesce);
+        Colleague_t *a = newColleague("A", m);
+        Colleague_t *b = newColleague("B", m);
+        Colleague_t *c = newColleague("C", m);
+        Colleague_t *d = newColleague("D", m);
+
+        a->update = b->update = c->update = d->update = colleagueUpdateVerbose;
+
+        /* A diamond: B and C follow A, D follows B and C */
+        m->addDependency(m, a, b);
+        m->addDependency(m, a, c);
+        m->addDependency(m, b, d);
+        m->addDependency(m, c, d);
+
+        printf("%s mediator, expecting D to update %s\n",
+               coalesce ? "Coalescing" : "Immediate", coalesce ? "once" : "twice");
+        a->set(a, 1);
+        printf("\n");
+    }
+
+    /*
+     * X follows Y although X was created first, so X is ranked after Y only
+     * once the dependency is known. Both change in the same wave.
+     */
+    for (int coalesce = 0; coalesce <= 1; coalesce++) {
+        Mediator_t *m = newMediator(coalesce);
+        Colleague_t *x = newColleague("X", m);
+        Colleague_t *y = newColleague("Y", m);
+
+        m->addDependency(m, y, x);
+
+        m->beginWave(m);
+        x->set(x, 1);
+        y->set(y, 10);
+        m->endWave(m);
+
+        printf("%s mediator, X follows Y: X = %lu (expecting 11)\n",
+               coalesce ? "Coalescing" : "Immediate", (unsigned long) x->value);
+
+        /* a dependency added to an already ranked graph, during a wave */
+        Colleague_t *z = newColleague("Z", m);
+
+        m->beginWave(m);
+        x->set(x, 2);
+        m->addDependency(m, z, x);
+        z->set(z, 3);
+        m->endWave(m);
+
+        printf("%s mediator, X also follows Z: X = %lu (expecting 15)\n",
+               coalesce ? "Coalescing" : "Immediate", (unsigned long) x->value);
+    }
+    printf("\n");
+
+    for (int layers = 2; layers <= MAX_LAYERS; layers += 2) {
+        runBenchmark(layers);
+    }
+
+    return 0;
+}
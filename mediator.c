@@ -67,13 +67,15 @@ void mediatorAddColleague(Mediator_t *m, Colleague_t *c)
 
 void mediatorColleagueUpdate(Mediator_t *m, Colleague_t *c)
 {
-    printf("MEDIATOR received update from COLLEAGUE %s\n");
+    printf("MEDIATOR received update from COLLEAGUE %s\n", c->id);
 
     /* Update all remaining colleagues... */
     for (int k = 0; k < MAX_COLLEAGUES; k++) {
         if (c == m->colleagues[k]) {
             for (int j = k + 1; j < MAX_COLLEAGUES; j++) {
-                m->colleagues[j]->update(m->colleagues[j]);
+                if (m->colleagues[j]) {
+                    m->colleagues[j]->update(m->colleagues[j]);
+                }
                 break;
             }
         }
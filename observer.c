@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /**
  * Intent
@@ -20,6 +24,22 @@
  *   tightly coupled.
  */
 
+/**
+ * The subject keeps a separate list of observers for every event, so a
+ * notification only reaches the observers that asked for that event, however
+ * many others are attached. The lists are contiguous arrays that grow as
+ * observers attach, and the table of lists grows to cover any event.
+ */
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
 typedef enum {
     EVENT_1 = 1,
     EVENT_2,
@@ -29,9 +49,17 @@ typedef enum {
 typedef struct Subject_s Subject_t;
 typedef struct Observer_s Observer_t;
 
-#define MAX_OBSERVERS 3
+/* The observers of one event, in the order they attached */
+typedef struct ObserverList_s {
+    Observer_t **obs;
+    size_t count;
+    size_t capacity;
+} ObserverList_t;
+
 struct Subject_s {
-    Observer_t *obs[MAX_OBSERVERS];
+    ObserverList_t *events;     /* indexed by Event_t */
+    size_t numEvents;
+    int trace;
 
     void (*attach)(Subject_t *, Observer_t *);
     void (*detach)(Subject_t *, Observer_t *);
@@ -42,29 +70,64 @@ struct Subject_s {
 struct Observer_s {
     char id[MAX_OBSERVER_ID_LEN];
     Event_t myEvent;
+    unsigned long received;
 
     void (*update)(Observer_t *, Event_t e);
 };
 
 void subjectAttach(Subject_t *subject, Observer_t *obs)
 {
-    for (int k = 0; k < MAX_OBSERVERS; k++) {
-        if (subject->obs[k] == NULL) {
-            printf("\tSUBJECT attaching OBSERVER_%s\n", obs->id);
+    size_t e = (size_t) obs->myEvent;
 
-            subject->obs[k] = obs;
-            break;
+    if (subject->trace) {
+        printf("\tSUBJECT attaching OBSERVER_%s\n", obs->id);
+    }
+
+    if (e >= subject->numEvents) {
+        size_t numEvents = subject->numEvents ? subject->numEvents : 8;
+
+        while (numEvents <= e) {
+            numEvents *= 2;
         }
+
+        subject->events = (ObserverList_t *) realloc(subject->events,
+                                                     numEvents * sizeof(ObserverList_t));
+        memset(subject->events + subject->numEvents, 0,
+               (numEvents - subject->numEvents) * sizeof(ObserverList_t));
+        subject->numEvents = numEvents;
+    }
+
+    ObserverList_t *list = &subject->events[e];
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 4;
+        list->obs = (Observer_t **) realloc(list->obs,
+                                            list->capacity * sizeof(Observer_t *));
     }
+
+    list->obs[list->count++] = obs;
 }
 
 void subjectDetach(Subject_t *subject, Observer_t *obs)
 {
-    for (int k = 0; k < MAX_OBSERVERS; k++) {
-        if (subject->obs[k] == obs) {
-            printf("\tSUBJECT detaching OBSERVER_%s\n", obs->id);
+    size_t e = (size_t) obs->myEvent;
+
+    if (e >= subject->numEvents) {
+        return;
+    }
 
-            subject->obs[k] = NULL;
+    ObserverList_t *list = &subject->events[e];
+
+    for (size_t k = 0; k < list->count; k++) {
+        if (list->obs[k] == obs) {
+            if (subject->trace) {
+                printf("\tSUBJECT detaching OBSERVER_%s\n", obs->id);
+            }
+
+            /* keep the others in the order they attached */
+            memmove(&list->obs[k], &list->obs[k + 1],
+                    (list->count - k - 1) * sizeof(Observer_t *));
+            list->count--;
             break;
         }
     }
@@ -72,24 +135,26 @@ void subjectDetach(Subject_t *subject, Observer_t *obs)
 
 void subjectNotify(Subject_t *subject, Event_t e)
 {
-    printf("\tSUBJECT notifying EVENT %u\n", (unsigned) e);
+    if (subject->trace) {
+        printf("\tSUBJECT notifying EVENT %u\n", (unsigned) e);
+    }
 
-    for (int k = 0; k < MAX_OBSERVERS; k++) {
-        Observer_t *obs = subject->obs[k];
+    if ((size_t) e >= subject->numEvents) {
+        return;     /* nobody ever attached for this event */
+    }
 
-        if (obs) {
-            obs->update(obs, e);
-        }
+    ObserverList_t *list = &subject->events[e];
+
+    for (size_t k = 0; k < list->count; k++) {
+        list->obs[k]->update(list->obs[k], e);
     }
 }
 
 Subject_t * newSubject(void)
 {
-    Subject_t *subject = (Subject_t *) malloc(sizeof(Subject_t));
+    Subject_t *subject = (Subject_t *) calloc(1, sizeof(Subject_t));
 
-    for (int k = 0; k < MAX_OBSERVERS; k++) {
-        subject->obs[k] = NULL;
-    }
+    subject->trace = 1;
 
     subject->attach = subjectAttach;
     subject->detach = subjectDetach;
@@ -100,16 +165,23 @@ Subject_t * newSubject(void)
 
 void observerUpdate(Observer_t *obs, Event_t e)
 {
-    /* This gets called from the subject */
+    /* This gets called from the subject, for myEvent only */
+    obs->received++;
+    printf("\t\tOBSERVER_%s has received the update for EVENT %d\n",
+           obs->id, e);
+}
+
+/* What every observer had to do when it was sent all events */
+void observerCountMine(Observer_t *obs, Event_t e)
+{
     if (obs->myEvent == e) {
-        printf("\t\tOBSERVER_%s has received the update for EVENT %d\n",
-               obs->id, e);
+        obs->received++;
     }
 }
 
 Observer_t * newObserver(const char *id, Subject_t *subject, Event_t e)
 {
-    Observer_t *observer = (Observer_t *) malloc(sizeof(Observer_t));
+    Observer_t *observer = (Observer_t *) calloc(1, sizeof(Observer_t));
 
     strncpy(observer->id, id, MAX_OBSERVER_ID_LEN);
     observer->myEvent = e;
@@ -121,6 +193,72 @@ Observer_t * newObserver(const char *id, Subject_t *subject, Event_t e)
     return observer;
 }
 
+/*
+ * Benchmark: BENCH_OBSERVERS observers spread over BENCH_EVENTS event types,
+ * notified of BENCH_NOTIFIES random events. The subject's per-event lists are
+ * compared with sending every event to every observer and letting it filter.
+ */
+#define BENCH_OBSERVERS 10000
+#define BENCH_EVENTS 100
+#define BENCH_NOTIFIES 20000
+
+static unsigned long totalReceived(Observer_t **observers)
+{
+    unsigned long received = 0;
+
+    for (int k = 0; k < BENCH_OBSERVERS; k++) {
+        received += observers[k]->received;
+        observers[k]->received = 0;
+    }
+
+    return received;
+}
+
+static void runBenchmark(void)
+{
+    Subject_t *subject = newSubject();
+    Observer_t **observers = (Observer_t **) malloc(BENCH_OBSERVERS * sizeof(Observer_t *));
+    Event_t *events = (Event_t *) malloc(BENCH_NOTIFIES * sizeof(Event_t));
+    unsigned seed = 31;
+    char id[MAX_OBSERVER_ID_LEN];
+
+    subject->trace = 0;
+
+    for (int k = 0; k < BENCH_OBSERVERS; k++) {
+        snprintf(id, sizeof(id), "%d", k);
+        observers[k] = newObserver(id, subject, (Event_t) (1 + k % BENCH_EVENTS));
+        observers[k]->update = observerCountMine;
+    }
+
+    for (int k = 0; k < BENCH_NOTIFIES; k++) {
+        seed = seed * 1103515245u + 12345u;
+        events[k] = (Event_t) (1 + (seed >> 8) % BENCH_EVENTS);
+    }
+
+    uint64_t start = nowNs();
+    for (int k = 0; k < BENCH_NOTIFIES; k++) {
+        for (int j = 0; j < BENCH_OBSERVERS; j++) {
+            observers[j]->update(observers[j], events[k]);
+        }
+    }
+    uint64_t broadcastNs = nowNs() - start;
+    unsigned long broadcastReceived = totalReceived(observers);
+
+    start = nowNs();
+    for (int k = 0; k < BENCH_NOTIFIES; k++) {
+        subject->notify(subject, events[k]);
+    }
+    uint64_t indexedNs = nowNs() - start;
+    unsigned long indexedReceived = totalReceived(observers);
+
+    printf("\n%d observers over %d events, %d notifications\n",
+           BENCH_OBSERVERS, BENCH_EVENTS, BENCH_NOTIFIES);
+    printf("every observer   %9.0f ns/notify\n", (double) broadcastNs / BENCH_NOTIFIES);
+    printf("per-event lists  %9.0f ns/notify  (%.0fx)  %s\n",
+           (double) indexedNs / BENCH_NOTIFIES, (double) broadcastNs / indexedNs,
+           broadcastReceived == indexedReceived ? "same deliveries" : "DELIVERIES DIFFER");
+}
+
 int main(void)
 {
     /* This is the subject of interest to the observers */
@@ -142,5 +280,7 @@ int main(void)
     subject->notify(subject, EVENT_1);
     subject->notify(subject, EVENT_2);
 
+    runBenchmark();
+
     return 0;
 }
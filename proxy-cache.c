@@ -0,0 +1,440 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Caching proxy
+ * - A smart reference that remembers the answers of a slow real subject. The
+ *   proxy has the same interface as the real subject, so clients cannot tell
+ *   whether a request was served from the cache or forwarded.
+ */
+
+/**
+ * The cache is split into shards, each guarded by its own lock (lock
+ * striping), so that requests for unrelated keys rarely contend. Every shard
+ * keeps
+ * - a chained hash table for lookups,
+ * - an LRU list that is trimmed whenever the shard exceeds its share of the
+ *   memory cap,
+ * - a time-to-live on each entry, after which the entry is treated as a miss.
+ *
+ * Concurrent misses on the same key are coalesced: the first thread inserts a
+ * pending entry and asks the real subject, every other thread waits for that
+ * answer instead of issuing its own backend call.
+ */
+
+typedef struct Subject_s Subject_t;
+
+struct Subject_s {
+    struct Subject_s *realRef;
+
+    long (*request)(Subject_t *, long key);
+};
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Real subject
+ *
+ * Pretends to be a slow backend: every request sleeps for a fixed latency and
+ * then answers with a value derived from the key.
+ */
+typedef struct SlowSubject_s {
+    Subject_t base;
+
+    long latencyNs;
+    unsigned long calls;
+    pthread_mutex_t lock;
+} SlowSubject_t;
+
+long slowRequest(Subject_t *subject, long key)
+{
+    SlowSubject_t *s = (SlowSubject_t *) subject;
+    struct timespec ts = { 0, s->latencyNs };
+
+    pthread_mutex_lock(&s->lock);
+    s->calls++;
+    pthread_mutex_unlock(&s->lock);
+
+    nanosleep(&ts, NULL);
+
+    return key * key;
+}
+
+SlowSubject_t * newSlowSubject(long latencyNs)
+{
+    SlowSubject_t *s = (SlowSubject_t *) malloc(sizeof(SlowSubject_t));
+
+    s->base.realRef = &s->base;
+    s->base.request = slowRequest;
+    s->latencyNs = latencyNs;
+    s->calls = 0;
+    pthread_mutex_init(&s->lock, NULL);
+
+    return s;
+}
+
+/*
+ * Caching proxy
+ */
+typedef struct CacheEntry_s CacheEntry_t;
+
+struct CacheEntry_s {
+    long key;
+    long value;
+    uint64_t expiresNs;
+    int pending;  /* a backend call for this key is in flight */
+    int waiters;  /* threads parked on this entry until it is filled */
+
+    CacheEntry_t *chain;       /* next entry in the same bucket */
+    CacheEntry_t *lruPrev;     /* towards most recently used */
+    CacheEntry_t *lruNext;     /* towards least recently used */
+};
+
+#define CACHE_SHARDS 16
+#define SHARD_BUCKETS 1024
+
+typedef struct CacheShard_s {
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+
+    CacheEntry_t *buckets[SHARD_BUCKETS];
+    CacheEntry_t *lruHead;
+    CacheEntry_t *lruTail;
+    size_t bytes;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} CacheShard_t;
+
+typedef struct CachingProxy_s {
+    Subject_t base;
+
+    uint64_t ttlNs;
+    size_t shardByteCap;
+    CacheShard_t shards[CACHE_SHARDS];
+} CachingProxy_t;
+
+static uint64_t hashKey(long key)
+{
+    uint64_t h = (uint64_t) key;
+
+    /* splitmix64 finalizer, spreads sequential keys across shards */
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+
+    return h;
+}
+
+static void lruUnlink(CacheShard_t *shard, CacheEntry_t *e)
+{
+    if (e->lruPrev) {
+        e->lruPrev->lruNext = e->lruNext;
+    } else {
+        shard->lruHead = e->lruNext;
+    }
+
+    if (e->lruNext) {
+        e->lruNext->lruPrev = e->lruPrev;
+    } else {
+        shard->lruTail = e->lruPrev;
+    }
+
+    e->lruPrev = e->lruNext = NULL;
+}
+
+static void lruPushFront(CacheShard_t *shard, CacheEntry_t *e)
+{
+    e->lruPrev = NULL;
+    e->lruNext = shard->lruHead;
+
+    if (shard->lruHead) {
+        shard->lruHead->lruPrev = e;
+    } else {
+        shard->lruTail = e;
+    }
+
+    shard->lruHead = e;
+}
+
+static void shardRemove(CacheShard_t *shard, CacheEntry_t *e, size_t bucket)
+{
+    CacheEntry_t **link = &shard->buckets[bucket];
+
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+
+    lruUnlink(shard, e);
+    shard->bytes -= sizeof(CacheEntry_t);
+
+    free(e);
+}
+
+/*
+ * Drop least recently used entries until the shard fits its budget again.
+ * Entries that are still pending, or that parked threads have yet to read,
+ * are never evicted.
+ */
+static void shardEvict(CachingProxy_t *proxy, CacheShard_t *shard)
+{
+    CacheEntry_t *e = shard->lruTail;
+
+    while (shard->bytes > proxy->shardByteCap && e) {
+        CacheEntry_t *prev = e->lruPrev;
+
+        if (!e->pending && !e->waiters) {
+            shardRemove(shard, e, (hashKey(e->key) >> 8) % SHARD_BUCKETS);
+            shard->evictions++;
+        }
+
+        e = prev;
+    }
+}
+
+long cachingProxyRequest(Subject_t *subject, long key)
+{
+    CachingProxy_t *proxy = (CachingProxy_t *) subject;
+    uint64_t h = hashKey(key);
+    CacheShard_t *shard = &proxy->shards[h % CACHE_SHARDS];
+    size_t bucket = (h >> 8) % SHARD_BUCKETS;
+    CacheEntry_t *e;
+    long value;
+
+    pthread_mutex_lock(&shard->lock);
+
+    for (e = shard->buckets[bucket]; e; e = e->chain) {
+        if (e->key == key) {
+            break;
+        }
+    }
+
+    if (e && e->pending) {
+        /* Somebody else is already asking the real subject, wait for them */
+        e->waiters++;
+        while (e->pending) {
+            pthread_cond_wait(&shard->filled, &shard->lock);
+        }
+        e->waiters--;
+        shard->hits++;
+        value = e->value;
+        pthread_mutex_unlock(&shard->lock);
+
+        return value;
+    }
+
+    if (e && e->expiresNs > nowNs()) {
+        shard->hits++;
+        lruUnlink(shard, e);
+        lruPushFront(shard, e);
+        value = e->value;
+        pthread_mutex_unlock(&shard->lock);
+
+        return value;
+    }
+
+    shard->misses++;
+
+    if (!e) {
+        e = (CacheEntry_t *) malloc(sizeof(CacheEntry_t));
+        e->key = key;
+        e->waiters = 0;
+        e->chain = shard->buckets[bucket];
+        shard->buckets[bucket] = e;
+        shard->bytes += sizeof(CacheEntry_t);
+    } else {
+        lruUnlink(shard, e);  /* expired, refresh it in place */
+    }
+
+    e->pending = 1;
+    lruPushFront(shard, e);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    value = subject->realRef->request(subject->realRef, key);
+
+    pthread_mutex_lock(&shard->lock);
+
+    e->value = value;
+    e->expiresNs = nowNs() + proxy->ttlNs;
+    e->pending = 0;
+    pthread_cond_broadcast(&shard->filled);
+
+    shardEvict(proxy, shard);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return value;
+}
+
+CachingProxy_t * newCachingProxy(Subject_t *realRef, uint64_t ttlNs,
+                                 size_t byteCap)
+{
+    CachingProxy_t *proxy = (CachingProxy_t *) calloc(1, sizeof(CachingProxy_t));
+
+    proxy->base.realRef = realRef;
+    proxy->base.request = cachingProxyRequest;
+    proxy->ttlNs = ttlNs;
+    proxy->shardByteCap = byteCap / CACHE_SHARDS;
+
+    for (int k = 0; k < CACHE_SHARDS; k++) {
+        pthread_mutex_init(&proxy->shards[k].lock, NULL);
+        pthread_cond_init(&proxy->shards[k].filled, NULL);
+    }
+
+    return proxy;
+}
+
+void cachingProxyStats(CachingProxy_t *proxy, unsigned long *hits,
+                       unsigned long *misses, unsigned long *evictions,
+                       size_t *bytes)
+{
+    *hits = *misses = *evictions = 0;
+    *bytes = 0;
+
+    for (int k = 0; k < CACHE_SHARDS; k++) {
+        CacheShard_t *shard = &proxy->shards[k];
+
+        pthread_mutex_lock(&shard->lock);
+        *hits += shard->hits;
+        *misses += shard->misses;
+        *evictions += shard->evictions;
+        *bytes += shard->bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/*
+ * Benchmark
+ *
+ * Several client threads issue requests drawn from a skewed key distribution
+ * (a few hot keys, a long tail of cold ones), once straight at the slow subject
+ * and once through the caching proxy.
+ */
+#define BENCH_THREADS 4
+#define BENCH_REQUESTS 5000
+#define BENCH_KEYS 20000
+
+typedef struct BenchArgs_s {
+    Subject_t *subject;
+    unsigned seed;
+    uint64_t *latencies;
+} BenchArgs_t;
+
+static long skewedKey(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    unsigned r = (*seed >> 8) % 100;
+
+    /* 80% of the traffic goes to 1% of the keys */
+    if (r < 80) {
+        return (long) ((*seed >> 4) % (BENCH_KEYS / 100));
+    }
+
+    return (long) ((*seed >> 4) % BENCH_KEYS);
+}
+
+static void * benchClient(void *arg)
+{
+    BenchArgs_t *a = (BenchArgs_t *) arg;
+
+    for (int k = 0; k < BENCH_REQUESTS; k++) {
+        long key = skewedKey(&a->seed);
+        uint64_t start = nowNs();
+
+        a->subject->request(a->subject, key);
+
+        a->latencies[k] = nowNs() - start;
+    }
+
+    return NULL;
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void runBenchmark(const char *name, Subject_t *subject,
+                         SlowSubject_t *backend)
+{
+    pthread_t threads[BENCH_THREADS];
+    BenchArgs_t args[BENCH_THREADS];
+    size_t total = BENCH_THREADS * BENCH_REQUESTS;
+    uint64_t *latencies = (uint64_t *) malloc(total * sizeof(uint64_t));
+    unsigned long callsBefore = backend->calls;
+    uint64_t start = nowNs();
+
+    for (int t = 0; t < BENCH_THREADS; t++) {
+        args[t].subject = subject;
+        args[t].seed = 42 + t;
+        args[t].latencies = &latencies[t * BENCH_REQUESTS];
+        pthread_create(&threads[t], NULL, benchClient, &args[t]);
+    }
+
+    for (int t = 0; t < BENCH_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    uint64_t elapsed = nowNs() - start;
+
+    qsort(latencies, total, sizeof(uint64_t), compareU64);
+
+    printf("%-14s %8.0f req/s  p50 %7.1f us  p99 %7.1f us  backend calls %lu\n",
+           name, total / (elapsed / 1e9),
+           latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3,
+           backend->calls - callsBefore);
+
+    free(latencies);
+}
+
+int main(void)
+{
+    /* The real subject: 20 us per request */
+    SlowSubject_t *backend = newSlowSubject(20000);
+
+    /*
+     * The proxy caches answers for one second and may hold up to 64 KiB of
+     * entries, well below what the whole key space would need.
+     */
+    CachingProxy_t *proxy = newCachingProxy(&backend->base, 1000000000ull,
+                                            64 * 1024);
+
+    printf("FIRST REQUEST\n");
+    printf("answer %ld\n", proxy->base.request(&proxy->base, 12));
+    printf("SECOND REQUEST (served from the cache)\n");
+    printf("answer %ld\n", proxy->base.request(&proxy->base, 12));
+    printf("backend calls so far: %lu\n\n", backend->calls);
+
+    runBenchmark("direct", &backend->base, backend);
+    runBenchmark("caching proxy", &proxy->base, backend);
+
+    unsigned long hits, misses, evictions;
+    size_t bytes;
+
+    cachingProxyStats(proxy, &hits, &misses, &evictions, &bytes);
+    printf("hit rate %.1f%%, evictions %lu, resident %zu bytes\n",
+           100.0 * hits / (hits + misses), evictions, bytes);
+
+    return 0;
+}
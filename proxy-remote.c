@@ -0,0 +1,487 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Remote proxy
+ * - A local representative for an object that lives in a different address
+ *   space. The client talks to the proxy through the usual Subject_t interface,
+ *   and the proxy forwards every request to a server process over a Unix
+ *   domain socket.
+ */
+
+/**
+ * Requests and responses are sent as fixed-size binary frames:
+ *
+ *   request:  | id (u32) | op (u32) | arg (i64) |
+ *   response: | id (u32) | status (u32) | value (i64) |
+ *
+ * Every request carries an id so that the proxy can keep many requests in
+ * flight on one connection (pipelining) and match the responses as they come
+ * back. Outgoing frames are collected in a send buffer and written in batches,
+ * so a burst of requests costs one system call instead of one per request.
+ */
+
+typedef struct Subject_s Subject_t;
+
+struct Subject_s {
+    struct Subject_s *realRef;
+
+    long (*request)(Subject_t *, long arg);
+};
+
+typedef struct RequestFrame_s {
+    uint32_t id;
+    uint32_t op;
+    int64_t arg;
+} RequestFrame_t;
+
+typedef struct ResponseFrame_s {
+    uint32_t id;
+    uint32_t status;
+    int64_t value;
+} ResponseFrame_t;
+
+#define OP_SQUARE 1
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        p += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+/*
+ * Real subject
+ *
+ * Lives in the stand-in server process only.
+ */
+long realRequest(Subject_t *subject, long arg)
+{
+    return arg * arg;
+}
+
+Subject_t * newSubject(void)
+{
+    Subject_t *s = (Subject_t *) malloc(sizeof(Subject_t));
+
+    s->realRef = s; /* real subjects reference is itself */
+
+    s->request = realRequest;
+
+    return s;
+}
+
+/*
+ * Stand-in server
+ *
+ * Reads whatever frames have arrived, answers all of them, and writes the
+ * answers back with a single write.
+ */
+#define SERVER_BATCH 256
+
+void serveConnection(int fd, Subject_t *subject)
+{
+    RequestFrame_t in[SERVER_BATCH];
+    ResponseFrame_t out[SERVER_BATCH];
+    size_t have = 0;
+
+    for (;;) {
+        ssize_t n = read(fd, (char *) in + have, sizeof(in) - have);
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        have += (size_t) n;
+
+        size_t frames = have / sizeof(RequestFrame_t);
+
+        for (size_t k = 0; k < frames; k++) {
+            out[k].id = in[k].id;
+
+            if (in[k].op == OP_SQUARE) {
+                out[k].status = 0;
+                out[k].value = subject->request(subject, (long) in[k].arg);
+            } else {
+                out[k].status = 1;
+                out[k].value = 0;
+            }
+        }
+
+        if (writeAll(fd, out, frames * sizeof(ResponseFrame_t)) < 0) {
+            return;
+        }
+
+        /* keep a trailing partial frame for the next read */
+        have -= frames * sizeof(RequestFrame_t);
+        memmove(in, (char *) in + frames * sizeof(RequestFrame_t), have);
+    }
+}
+
+void runServer(const char *path)
+{
+    struct sockaddr_un addr;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    Subject_t *subject = newSubject();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(lfd, 8) < 0) {
+        perror("server");
+        exit(1);
+    }
+
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        serveConnection(fd, subject);
+        close(fd);
+    }
+}
+
+/*
+ * Remote proxy
+ */
+#define MAX_INFLIGHT 1024   /* power of two */
+#define SEND_BATCH 64
+
+typedef struct Inflight_s {
+    uint32_t id;
+    int done;
+    long value;
+} Inflight_t;
+
+typedef struct RemoteProxy_s {
+    Subject_t base;
+
+    int fd;
+    uint32_t nextId;
+    uint32_t oldestId;  /* every id below this has been collected */
+
+    RequestFrame_t sendBuf[SEND_BATCH];
+    size_t sendCount;
+
+    char recvBuf[64 * sizeof(ResponseFrame_t)];
+    size_t recvHave;
+
+    Inflight_t inflight[MAX_INFLIGHT];
+} RemoteProxy_t;
+
+void remoteProxyFlush(RemoteProxy_t *proxy)
+{
+    if (proxy->sendCount > 0) {
+        writeAll(proxy->fd, proxy->sendBuf,
+                 proxy->sendCount * sizeof(RequestFrame_t));
+        proxy->sendCount = 0;
+    }
+}
+
+/*
+ * Read one batch of responses from the socket and file them under their ids.
+ */
+static int remoteProxyReceive(RemoteProxy_t *proxy)
+{
+    ssize_t n = read(proxy->fd, proxy->recvBuf + proxy->recvHave,
+                     sizeof(proxy->recvBuf) - proxy->recvHave);
+
+    if (n <= 0) {
+        return -1;
+    }
+
+    proxy->recvHave += (size_t) n;
+
+    size_t frames = proxy->recvHave / sizeof(ResponseFrame_t);
+
+    for (size_t k = 0; k < frames; k++) {
+        ResponseFrame_t r;
+
+        memcpy(&r, proxy->recvBuf + k * sizeof(r), sizeof(r));
+
+        Inflight_t *slot = &proxy->inflight[r.id & (MAX_INFLIGHT - 1)];
+
+        if (slot->id == r.id) {
+            slot->value = r.status == 0 ? (long) r.value : -1;
+            slot->done = 1;
+        }
+    }
+
+    proxy->recvHave -= frames * sizeof(ResponseFrame_t);
+    memmove(proxy->recvBuf, proxy->recvBuf + frames * sizeof(ResponseFrame_t),
+            proxy->recvHave);
+
+    return 0;
+}
+
+/*
+ * Wait until the response for id has arrived and return its value. Returns -1
+ * for an id that is not outstanding, e.g. one that was already collected.
+ */
+long remoteProxyWait(RemoteProxy_t *proxy, uint32_t id)
+{
+    Inflight_t *slot = &proxy->inflight[id & (MAX_INFLIGHT - 1)];
+
+    if (slot->id != id) {
+        return -1;
+    }
+
+    remoteProxyFlush(proxy);
+
+    while (!slot->done) {
+        if (remoteProxyReceive(proxy) < 0) {
+            return -1;
+        }
+    }
+
+    /* advance past every response that has been collected in order */
+    slot->id = UINT32_MAX;
+    while (proxy->oldestId != proxy->nextId
+           && proxy->inflight[proxy->oldestId & (MAX_INFLIGHT - 1)].id
+              == UINT32_MAX) {
+        proxy->oldestId++;
+    }
+
+    return slot->value;
+}
+
+/*
+ * Queue a request without waiting for its answer and store its id in *id, to
+ * be handed to remoteProxyWait later. Returns -1 if MAX_INFLIGHT requests are
+ * outstanding: the new request would need the slot of the oldest one, whose
+ * answer belongs to whoever submitted it, so that one has to be collected
+ * first.
+ */
+int remoteProxySubmit(RemoteProxy_t *proxy, long arg, uint32_t *idOut)
+{
+    uint32_t id = proxy->nextId;
+    Inflight_t *slot = &proxy->inflight[id & (MAX_INFLIGHT - 1)];
+
+    if (id - proxy->oldestId >= MAX_INFLIGHT) {
+        return -1;
+    }
+
+    proxy->nextId++;
+
+    slot->id = id;
+    slot->done = 0;
+
+    proxy->sendBuf[proxy->sendCount].id = id;
+    proxy->sendBuf[proxy->sendCount].op = OP_SQUARE;
+    proxy->sendBuf[proxy->sendCount].arg = arg;
+
+    if (++proxy->sendCount == SEND_BATCH) {
+        remoteProxyFlush(proxy);
+    }
+
+    *idOut = id;
+
+    return 0;
+}
+
+/*
+ * The plain Subject_t interface: one request, one round trip.
+ */
+long remoteProxyRequest(Subject_t *subject, long arg)
+{
+    RemoteProxy_t *proxy = (RemoteProxy_t *) subject;
+    uint32_t id;
+
+    if (remoteProxySubmit(proxy, arg, &id) < 0) {
+        return -1;
+    }
+
+    return remoteProxyWait(proxy, id);
+}
+
+RemoteProxy_t * newRemoteProxy(const char *path)
+{
+    RemoteProxy_t *proxy = (RemoteProxy_t *) calloc(1, sizeof(RemoteProxy_t));
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    proxy->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    /* the server may still be starting up */
+    for (int tries = 0; ; tries++) {
+        if (connect(proxy->fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            break;
+        }
+
+        if (tries == 100) {
+            perror("connect");
+            exit(1);
+        }
+
+        struct timespec ts = { 0, 10000000 };
+        nanosleep(&ts, NULL);
+    }
+
+    for (int k = 0; k < MAX_INFLIGHT; k++) {
+        proxy->inflight[k].id = UINT32_MAX;
+    }
+
+    /* the real subject lives on the other side of the socket */
+    proxy->base.realRef = NULL;
+    proxy->base.request = remoteProxyRequest;
+
+    return proxy;
+}
+
+/*
+ * Benchmark
+ */
+#define BENCH_REQUESTS 200000
+
+static void benchSynchronous(RemoteProxy_t *proxy)
+{
+    uint64_t start = nowNs();
+
+    for (long k = 0; k < BENCH_REQUESTS; k++) {
+        proxy->base.request(&proxy->base, k);
+    }
+
+    uint64_t elapsed = nowNs() - start;
+
+    printf("synchronous          %9.0f req/s  mean latency %7.2f us\n",
+           BENCH_REQUESTS / (elapsed / 1e9),
+           elapsed / 1e3 / BENCH_REQUESTS);
+}
+
+static void benchPipelined(RemoteProxy_t *proxy, int window)
+{
+    uint32_t *ids = (uint32_t *) malloc(window * sizeof(uint32_t));
+    uint64_t *sent = (uint64_t *) malloc(window * sizeof(uint64_t));
+    uint64_t latencySum = 0;
+    uint64_t start = nowNs();
+    long bad = 0;
+
+    /* keep `window` requests outstanding at all times */
+    for (long k = 0; k < BENCH_REQUESTS + window; k++) {
+        int w = (int) (k % window);
+
+        if (k >= window) {
+            long arg = k - window;
+
+            if (remoteProxyWait(proxy, ids[w]) != arg * arg) {
+                bad++;
+            }
+            latencySum += nowNs() - sent[w];
+        }
+
+        if (k < BENCH_REQUESTS) {
+            sent[w] = nowNs();
+            remoteProxySubmit(proxy, k, &ids[w]);
+        }
+    }
+
+    uint64_t elapsed = nowNs() - start;
+
+    printf("pipelined, window %3d %9.0f req/s  mean latency %7.2f us%s\n",
+           window, BENCH_REQUESTS / (elapsed / 1e9),
+           latencySum / 1e3 / BENCH_REQUESTS, bad ? "  (WRONG ANSWERS)" : "");
+
+    free(ids);
+    free(sent);
+}
+
+int main(void)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/proxy-remote.%d.sock", (int) getpid());
+
+    pid_t server = fork();
+
+    if (server == 0) {
+        runServer(path);
+        _exit(0);
+    }
+
+    /*
+     * The client only ever sees a Subject_t. Whether its request is served in
+     * this process or another one is the proxy's business.
+     */
+    RemoteProxy_t *proxy = newRemoteProxy(path);
+    Subject_t *subject = &proxy->base;
+
+    printf("REMOTE REQUEST\n");
+    printf("7 x 7 = %ld\n\n", subject->request(subject, 7));
+
+    /* one more than the window holds: the last submit has to be refused */
+    uint32_t *ids = (uint32_t *) malloc((MAX_INFLIGHT + 1) * sizeof(uint32_t));
+    int accepted = 0;
+    long wrong = 0;
+
+    while (accepted <= MAX_INFLIGHT
+           && remoteProxySubmit(proxy, accepted, &ids[accepted]) == 0) {
+        accepted++;
+    }
+    for (int k = 0; k < accepted; k++) {
+        wrong += remoteProxyWait(proxy, ids[k]) != (long) k * k;
+    }
+    printf("%d of %d requests accepted with a window of %d, %ld wrong answers,"
+           " collecting twice gives %ld\n\n", accepted, MAX_INFLIGHT + 1,
+           MAX_INFLIGHT, wrong, remoteProxyWait(proxy, ids[0]));
+    free(ids);
+
+    benchSynchronous(proxy);
+    benchPipelined(proxy, 16);
+    benchPipelined(proxy, 256);
+
+    close(proxy->fd);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(path);
+
+    return 0;
+}
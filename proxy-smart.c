@@ -0,0 +1,585 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Smart reference proxy
+ * - Counts the number of references to the real object so that it can be
+ *   freed automatically when there are no more references.
+ */
+
+/**
+ * The difficult part of reference counting across threads is the window
+ * between reading a shared pointer and incrementing the count of the object
+ * it points to: another thread may drop the last reference and free the
+ * object in between.
+ *
+ * Freeing is therefore deferred with epoch-based reclamation. A thread reads
+ * shared pointers only inside an epoch critical section. When the count of a
+ * real subject drops to zero the subject is retired, not freed, and the
+ * memory is only given back once every thread has moved two epochs past the
+ * retirement, so no thread can still be looking at it.
+ *
+ * Every thread that uses the proxies registers for an epoch record and
+ * unregisters before it exits. Unregistering frees the record for the next
+ * thread and hands the objects the thread retired over to a global list,
+ * where they wait out their epochs like everybody else's. MAX_THREADS is thus
+ * a limit on threads registered at the same time, not over the process's
+ * lifetime.
+ *
+ * Build the ThreadSanitizer variant with `make proxy-smart-tsan` to run the
+ * stress test in main() under the race detector.
+ */
+
+typedef struct Subject_s Subject_t;
+
+struct Subject_s {
+    struct Subject_s *realRef;
+
+    long (*request)(Subject_t *);
+};
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Epoch-based reclamation
+ */
+#define MAX_THREADS 64
+#define RETIRE_SCAN 64  /* try to advance the epoch every this many retires */
+#define CACHE_LINE 64
+
+typedef struct Retired_s {
+    struct Retired_s *next;
+    void (*destroy)(struct Retired_s *);
+} Retired_t;
+
+typedef struct Limbo_s {
+    unsigned epoch;
+    Retired_t *head;
+} Limbo_t;
+
+/* One per cache line, so that threads do not share lines while they work */
+typedef struct EpochRecord_s {
+    _Alignas(CACHE_LINE) atomic_uint epoch;
+    atomic_int active;
+    atomic_int inUse;       /* registered to a thread */
+
+    /* owned by the thread, objects it retired in the last three epochs */
+    Limbo_t limbo[3];
+    unsigned retires;
+} EpochRecord_t;
+
+/* The limbo list of a thread that has unregistered */
+typedef struct Orphan_s {
+    struct Orphan_s *next;
+    Limbo_t limbo;
+} Orphan_t;
+
+static atomic_uint globalEpoch = 2;
+static atomic_int numRecords;   /* records ever used, a high-water mark */
+static EpochRecord_t records[MAX_THREADS];
+static _Thread_local EpochRecord_t *myRecord;
+
+static pthread_mutex_t orphanLock = PTHREAD_MUTEX_INITIALIZER;
+static Orphan_t *orphans;
+static atomic_int numOrphans;   /* lets reclaim skip the lock */
+
+static atomic_long subjectsAlive;
+
+static void freeLimbo(Limbo_t *limbo)
+{
+    Retired_t *r = limbo->head;
+
+    while (r) {
+        Retired_t *next = r->next;
+
+        r->destroy(r);
+        r = next;
+    }
+
+    limbo->head = NULL;
+}
+
+/*
+ * Anything retired two or more epochs ago can no longer be referenced.
+ */
+static void reclaimOrphans(unsigned epoch)
+{
+    Orphan_t *expired = NULL;
+
+    /* whoever holds the lock is already doing this */
+    if (atomic_load_explicit(&numOrphans, memory_order_relaxed) == 0
+        || pthread_mutex_trylock(&orphanLock) != 0) {
+        return;
+    }
+
+    for (Orphan_t **p = &orphans; *p; ) {
+        Orphan_t *o = *p;
+
+        if (o->limbo.epoch + 2 <= epoch) {
+            atomic_fetch_sub(&numOrphans, 1);
+            *p = o->next;
+            o->next = expired;
+            expired = o;
+        } else {
+            p = &o->next;
+        }
+    }
+
+    pthread_mutex_unlock(&orphanLock);
+
+    while (expired) {
+        Orphan_t *next = expired->next;
+
+        freeLimbo(&expired->limbo);
+        free(expired);
+        expired = next;
+    }
+}
+
+static void reclaim(EpochRecord_t *rec, unsigned epoch)
+{
+    for (int k = 0; k < 3; k++) {
+        if (rec->limbo[k].head && rec->limbo[k].epoch + 2 <= epoch) {
+            freeLimbo(&rec->limbo[k]);
+        }
+    }
+
+    reclaimOrphans(epoch);
+}
+
+static void tryAdvance(void)
+{
+    unsigned epoch = atomic_load(&globalEpoch);
+    int n = atomic_load(&numRecords);
+
+    for (int k = 0; k < n; k++) {
+        if (atomic_load(&records[k].active)
+            && atomic_load(&records[k].epoch) != epoch) {
+            return; /* somebody is still in an older epoch */
+        }
+    }
+
+    atomic_compare_exchange_strong(&globalEpoch, &epoch, epoch + 1);
+}
+
+void epochRegister(void)
+{
+    for (int k = 0; k < MAX_THREADS; k++) {
+        int unused = 0;
+
+        if (atomic_compare_exchange_strong(&records[k].inUse, &unused, 1)) {
+            int n = atomic_load(&numRecords);
+
+            while (n <= k && !atomic_compare_exchange_weak(&numRecords, &n, k + 1)) {
+            }
+
+            records[k].retires = 0;
+            myRecord = &records[k];
+            return;
+        }
+    }
+
+    fprintf(stderr, "too many threads\n");
+    exit(1);
+}
+
+/*
+ * Give up the thread's record. What it retired and could not free yet goes to
+ * the orphan list.
+ */
+void epochUnregister(void)
+{
+    EpochRecord_t *rec = myRecord;
+
+    for (int k = 0; k < 3; k++) {
+        if (rec->limbo[k].head) {
+            Orphan_t *o = (Orphan_t *) malloc(sizeof(Orphan_t));
+
+            o->limbo = rec->limbo[k];
+            rec->limbo[k].head = NULL;
+
+            pthread_mutex_lock(&orphanLock);
+            o->next = orphans;
+            orphans = o;
+            atomic_fetch_add(&numOrphans, 1);
+            pthread_mutex_unlock(&orphanLock);
+        }
+    }
+
+    myRecord = NULL;
+    atomic_store(&rec->active, 0);
+    atomic_store(&rec->inUse, 0);
+}
+
+/*
+ * Free everything still waiting for its epochs to pass. Only safe once no
+ * other thread is registered.
+ */
+void epochShutdown(void)
+{
+    if (myRecord) {
+        epochUnregister();
+    }
+
+    pthread_mutex_lock(&orphanLock);
+    while (orphans) {
+        Orphan_t *o = orphans;
+
+        orphans = o->next;
+        atomic_fetch_sub(&numOrphans, 1);
+        freeLimbo(&o->limbo);
+        free(o);
+    }
+    pthread_mutex_unlock(&orphanLock);
+}
+
+void epochEnter(void)
+{
+    EpochRecord_t *rec = myRecord;
+
+    atomic_store(&rec->active, 1);
+    atomic_store(&rec->epoch, atomic_load(&globalEpoch));
+}
+
+void epochExit(void)
+{
+    atomic_store(&myRecord->active, 0);
+}
+
+void epochRetire(Retired_t *r)
+{
+    EpochRecord_t *rec = myRecord;
+    unsigned epoch = atomic_load(&globalEpoch);
+    Limbo_t *limbo = &rec->limbo[epoch % 3];
+
+    if (limbo->epoch != epoch) {
+        /* the slot holds objects from three epochs ago, all safe to free */
+        freeLimbo(limbo);
+        limbo->epoch = epoch;
+    }
+
+    r->next = limbo->head;
+    limbo->head = r;
+
+    if (++rec->retires % RETIRE_SCAN == 0) {
+        tryAdvance();
+        reclaim(rec, atomic_load(&globalEpoch));
+    }
+}
+
+/*
+ * Real subject
+ */
+#define SUBJECT_MAGIC 0x5eb1ec7l
+
+typedef struct RealSubject_s {
+    Subject_t base;
+    Retired_t retired;
+
+    atomic_long refs;
+    long magic;
+    long payload;
+} RealSubject_t;
+
+long realRequest(Subject_t *subject)
+{
+    RealSubject_t *s = (RealSubject_t *) subject;
+
+    /* touching freed memory here is exactly what must never happen */
+    if (s->magic != SUBJECT_MAGIC) {
+        fprintf(stderr, "request on a freed subject\n");
+        abort();
+    }
+
+    return s->payload;
+}
+
+static void destroyRealSubject(Retired_t *r)
+{
+    RealSubject_t *s = (RealSubject_t *)
+        ((char *) r - offsetof(RealSubject_t, retired));
+
+    s->magic = 0;
+    free(s);
+
+    atomic_fetch_sub(&subjectsAlive, 1);
+}
+
+/* The creator holds the first reference */
+RealSubject_t * newRealSubject(long payload)
+{
+    RealSubject_t *s = (RealSubject_t *) malloc(sizeof(RealSubject_t));
+
+    s->base.realRef = &s->base;
+    s->base.request = realRequest;
+    s->retired.destroy = destroyRealSubject;
+    atomic_init(&s->refs, 1);
+    s->magic = SUBJECT_MAGIC;
+    s->payload = payload;
+
+    atomic_fetch_add(&subjectsAlive, 1);
+
+    return s;
+}
+
+/*
+ * Take a reference unless the count already reached zero, in which case the
+ * subject is on its way out and must not be revived.
+ */
+static int subjectTryRetain(RealSubject_t *s)
+{
+    long refs = atomic_load_explicit(&s->refs, memory_order_relaxed);
+
+    while (refs > 0) {
+        if (atomic_compare_exchange_weak_explicit(&s->refs, &refs, refs + 1,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void subjectRelease(RealSubject_t *s)
+{
+    if (atomic_fetch_sub_explicit(&s->refs, 1, memory_order_acq_rel) == 1) {
+        epochRetire(&s->retired);
+    }
+}
+
+/*
+ * A shared slot that always owns one reference to its current subject. Writers
+ * may replace the subject at any time.
+ */
+typedef struct SharedRef_s {
+    _Atomic(RealSubject_t *) subject;
+} SharedRef_t;
+
+void sharedRefStore(SharedRef_t *ref, RealSubject_t *s)
+{
+    epochEnter();
+    RealSubject_t *old = atomic_exchange(&ref->subject, s);
+    if (old) {
+        subjectRelease(old);
+    }
+    epochExit();
+}
+
+/*
+ * Smart proxy
+ */
+typedef struct SmartProxy_s {
+    Subject_t base;
+} SmartProxy_t;
+
+long smartProxyRequest(Subject_t *proxy)
+{
+    return proxy->realRef->request(proxy->realRef);
+}
+
+/*
+ * Bind the proxy to whatever subject the shared slot currently holds. Returns
+ * 0 if the slot is empty.
+ */
+int smartProxyAcquire(SmartProxy_t *proxy, SharedRef_t *ref)
+{
+    RealSubject_t *s;
+
+    epochEnter();
+    do {
+        s = atomic_load(&ref->subject);
+    } while (s && !subjectTryRetain(s));
+    epochExit();
+
+    proxy->base.realRef = s ? &s->base : NULL;
+    proxy->base.request = smartProxyRequest;
+
+    return s != NULL;
+}
+
+void smartProxyRelease(SmartProxy_t *proxy)
+{
+    RealSubject_t *s = (RealSubject_t *) proxy->base.realRef;
+
+    proxy->base.realRef = NULL;
+
+    epochEnter();
+    subjectRelease(s);
+    epochExit();
+}
+
+/*
+ * Benchmark and stress test
+ *
+ * Reader threads repeatedly acquire a proxy, issue a request and release it,
+ * while a writer keeps replacing the shared subject so that the last reference
+ * is regularly dropped by a reader rather than by the writer.
+ */
+#define BENCH_THREADS 4
+#define BENCH_ITERATIONS 200000
+
+static SharedRef_t shared;
+static atomic_int writerDone;
+
+static void * readerThread(void *arg)
+{
+    long *checksum = (long *) arg;
+    SmartProxy_t proxy;
+
+    epochRegister();
+
+    for (int k = 0; k < BENCH_ITERATIONS; k++) {
+        if (smartProxyAcquire(&proxy, &shared)) {
+            *checksum += proxy.base.request(&proxy.base);
+            smartProxyRelease(&proxy);
+        }
+    }
+
+    epochUnregister();
+
+    return NULL;
+}
+
+/* Registers, does a little work, and is gone */
+static void * shortReaderThread(void *arg)
+{
+    long *checksum = (long *) arg;
+    SmartProxy_t proxy;
+
+    epochRegister();
+
+    for (int k = 0; k < 100; k++) {
+        if (smartProxyAcquire(&proxy, &shared)) {
+            *checksum += proxy.base.request(&proxy.base);
+            smartProxyRelease(&proxy);
+        }
+        sharedRefStore(&shared, newRealSubject(k));
+    }
+
+    epochUnregister();
+
+    return NULL;
+}
+
+static void * writerThread(void *arg)
+{
+    long swaps = 0;
+
+    epochRegister();
+
+    while (!atomic_load(&writerDone)) {
+        sharedRefStore(&shared, newRealSubject(++swaps));
+        sched_yield();
+    }
+
+    *(long *) arg = swaps;
+
+    epochUnregister();
+
+    return NULL;
+}
+
+static void runBenchmark(int readers, int withWriter)
+{
+    pthread_t threads[BENCH_THREADS], writer;
+    long checksums[BENCH_THREADS] = { 0 };
+    long swaps = 0;
+    uint64_t start = nowNs();
+
+    atomic_store(&writerDone, 0);
+    if (withWriter) {
+        pthread_create(&writer, NULL, writerThread, &swaps);
+    }
+
+    for (int t = 0; t < readers; t++) {
+        pthread_create(&threads[t], NULL, readerThread, &checksums[t]);
+    }
+
+    for (int t = 0; t < readers; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    uint64_t elapsed = nowNs() - start;
+
+    atomic_store(&writerDone, 1);
+    if (withWriter) {
+        pthread_join(writer, NULL);
+    }
+
+    printf("%d reader(s)%s %10.0f acquire/release per second, %ld swaps\n",
+           readers, withWriter ? " + writer" : "         ",
+           (double) readers * BENCH_ITERATIONS / (elapsed / 1e9), swaps);
+}
+
+int main(void)
+{
+    epochRegister();
+
+    RealSubject_t *real = newRealSubject(42);
+    SmartProxy_t proxy;
+
+    /* The shared slot takes over the creator's reference */
+    sharedRefStore(&shared, real);
+
+    smartProxyAcquire(&proxy, &shared);
+    printf("Proxy request answered %ld, references held: %ld\n",
+           proxy.base.request(&proxy.base), atomic_load(&real->refs));
+
+    /* Replacing the subject while the proxy still holds it keeps it alive */
+    sharedRefStore(&shared, newRealSubject(43));
+    printf("After replacing it, references held: %ld\n",
+           atomic_load(&real->refs));
+
+    /* Dropping the last reference retires it for deferred reclamation */
+    smartProxyRelease(&proxy);
+    printf("Subjects alive before reclamation: %ld\n\n",
+           atomic_load(&subjectsAlive));
+
+    for (int readers = 1; readers <= BENCH_THREADS; readers *= 2) {
+        runBenchmark(readers, 0);
+        runBenchmark(readers, 1);
+    }
+
+    /* far more threads over time than there are epoch records */
+    for (int round = 0; round < 4 * MAX_THREADS / BENCH_THREADS; round++) {
+        pthread_t threads[BENCH_THREADS];
+        long checksums[BENCH_THREADS] = { 0 };
+
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            pthread_create(&threads[t], NULL, shortReaderThread, &checksums[t]);
+        }
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+    printf("\n%d short-lived threads registered, %d epoch records used\n",
+           4 * MAX_THREADS, atomic_load(&numRecords));
+
+    /*
+     * Every thread has finished: drop the last shared reference and free what
+     * is still waiting in the limbo lists. Exactly nothing must be left.
+     */
+    sharedRefStore(&shared, NULL);
+    epochShutdown();
+
+    printf("Subjects alive after shutdown: %ld\n",
+           atomic_load(&subjectsAlive));
+
+    return atomic_load(&subjectsAlive) != 0;
+}